@@ -0,0 +1,722 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+
+    The benchmarks: bench [name...]
+*/
+
+#include "match.hpp"
+#include "match/runtime.hpp"
+#include "match/image.hpp"
+#include "match/router.hpp"
+#include "match/batch.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <bitset>
+
+// Prevents the compiler from optimizing the results away.
+
+static volatile long sink_;
+
+template <typename F>
+double measure(const char* name, size_t n, F&& f)
+{
+    using clock_t = std::chrono::steady_clock;
+    f(n / 10 + 1); // warm up
+    auto t0 = clock_t::now();
+    f(n);
+    auto t1 = clock_t::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+    std::cout << "  " << std::left << std::setw(40) << name << std::right << std::setw(10) 
+              << std::fixed << std::setprecision(2) << ns << " ns/op" << std::endl;
+    return ns;
+}
+
+struct event_t
+{
+    int         kind_;
+    std::string topic_;
+    double      level_;
+};
+MATCH_REGIST_TYPE(event_t, int, std::string, double)
+
+std::vector<event_t> make_events(size_t n)
+{
+    const char* topics[] = { "disk", "net", "cpu", "mem", "gpu" };
+    std::mt19937 rng(42);
+    std::vector<event_t> evs(n);
+    for (auto& e : evs)
+    {
+        e.kind_  = static_cast<int>(rng() % 16);
+        e.topic_ = topics[rng() % 5];
+        e.level_ = (rng() % 1000) / 1000.0;
+    }
+    return evs;
+}
+
+/*
+ * The expression form against the statement form of a small match, on the random inputs
+ * (so the branches are mispredicted), and on the sorted ones (so they are predicted).
+*/
+
+void bench_when(void)
+{
+    using namespace match;
+    std::cout << "when:" << std::endl;
+    std::vector<int> xs(1 << 16);
+    std::mt19937 rng(1);
+    for (auto& x : xs) x = static_cast<int>(rng() % 128);
+
+    auto statement = [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            int v;
+            Match(xs[i & 0xffff])
+            {
+                Case(0)               v = 7;
+                Case(Range(1, 31))    v = 3;
+                Case(Range(32, 63))   v = 5;
+                Case(In(64, 65, 66))  v = 11;
+                Otherwise()           v = 1;
+            }
+            EndMatch
+            r += v;
+        }
+        sink_ = r;
+    };
+    auto expression = [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            r += when(xs[i & 0xffff])(case_(0)              >>= 7, 
+                                      case_(Range(1, 31))   >>= 3, 
+                                      case_(Range(32, 63))  >>= 5, 
+                                      case_(In(64, 65, 66)) >>= 11, 
+                                      case_(_)              >>= 1);
+        }
+        sink_ = r;
+    };
+    measure("Match statement, random", 10000000, statement);
+    measure("when expression, random", 10000000, expression);
+    std::sort(xs.begin(), xs.end());
+    measure("Match statement, sorted", 10000000, statement);
+    measure("when expression, sorted", 10000000, expression);
+}
+
+/*
+ * The batch classification of a column, against a Match on each element.
+*/
+
+void bench_batch(void)
+{
+    using namespace match;
+    std::cout << "batch (per element):" << std::endl;
+    std::vector<std::int32_t> xs(1 << 16);
+    std::mt19937 rng(5);
+    for (auto& x : xs) x = static_cast<std::int32_t>(rng() % 1000) - 100;
+    std::vector<std::uint8_t> out(xs.size());
+
+    measure("Match on each element", 20000000, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            std::uint8_t k;
+            Match(xs[i & 0xffff])
+            {
+                Case(0)              k = 0;
+                Case(Range(1, 99))   k = 1;
+                Case(Range(-100, -1)) k = 2;
+                Case(Range(500, 599)) k = 3;
+                Otherwise()          k = 4;
+            }
+            EndMatch
+            r += k;
+        }
+        sink_ = r;
+    });
+
+    auto table = batch<std::int32_t>(case_(0), case_(Range(1, 99)), case_(Range(-100, -1)), case_(Range(500, 599)));
+    const char* names[] = { "batch, scalar", "batch, SSE2", "batch, AVX2" };
+    for (auto lv : { simd::none, simd::sse2, simd::avx2 })
+    {
+        if (lv > simd_level()) break;
+        measure(names[static_cast<int>(lv)], 20000000, [&](size_t n)
+        {
+            for (size_t i = 0; i < n; i += xs.size())
+            {
+                table(xs.data(), std::min(xs.size(), n - i), out.data(), lv);
+            }
+            sink_ = out[0];
+        });
+    }
+}
+
+/*
+ * Matching the shared nodes of a hash-consed DAG again and again, with & without the memo.
+*/
+
+struct term
+{
+    int   op_;
+    term* l_;
+    term* r_;
+};
+MATCH_REGIST_TYPE(term, int, term*, term*)
+
+void bench_memo(void)
+{
+    using namespace match;
+    std::cout << "memo (per match):" << std::endl;
+    std::mt19937 rng(9);
+    std::vector<term> pool(512);
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        pool[i].op_ = static_cast<int>(rng() % 4);
+        pool[i].l_  = (i < 2) ? nullptr : &pool[rng() % i];
+        pool[i].r_  = (i < 2) ? nullptr : &pool[rng() % i];
+    }
+    auto is_op = [](int op) { return [op](const term* t) { return t && (t->op_ == op); }; };
+
+    measure("Match", 5000000, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const term& t = pool[i & 511];
+            Match(t)
+            {
+                Case(C<term>(0, is_op(1), is_op(2)))  r += 1;
+                Case(C<term>(1, is_op(0), is_op(0)))  r += 2;
+                Case(C<term>(2, is_op(3), _))         r += 3;
+                Case(C<term>(_, is_op(2), is_op(3)))  r += 4;
+            }
+            EndMatch
+        }
+        sink_ = r;
+    });
+    memo_clear();
+    measure("MemoMatch", 5000000, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const term& t = pool[i & 511];
+            MemoMatch(&t, t)
+            {
+                Case(C<term>(0, is_op(1), is_op(2)))  r += 1;
+                Case(C<term>(1, is_op(0), is_op(0)))  r += 2;
+                Case(C<term>(2, is_op(3), _))         r += 3;
+                Case(C<term>(_, is_op(2), is_op(3)))  r += 4;
+            }
+            EndMatch
+        }
+        sink_ = r;
+    });
+    auto s = memo_statistics();
+    std::cout << "  hit rate: " << std::setprecision(4) << 100.0 * s.hits_ / (s.hits_ + s.misses_) << "% (" << s.misses_ << " misses, " 
+              << s.evictions_ << " evictions)" << std::endl;
+}
+
+/*
+ * The runtime bytecode matcher, against the same rules written with the static Match.
+*/
+
+void bench_runtime(void)
+{
+    using namespace match;
+    std::cout << "runtime:" << std::endl;
+    auto evs = make_events(4096);
+
+    measure("static Match", 2000000, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto& e = evs[i & 4095];
+            Match(e)
+            {
+                Case(C<event_t>(Range(1, 3), "disk", _))            r += 1;
+                Case(C<event_t>(Range(4, 6), "net" , Range(0.5, 1.0))) r += 2;
+                Case(C<event_t>(7, _, Range(0.9, 1.0)))              r += 3;
+                Case(C<event_t>(_, "gpu", _))                        r += 4;
+            }
+            EndMatch
+        }
+        sink_ = r;
+    });
+
+    auto prog = rt::compile(R"(
+        event(1..3, "disk", _)
+        event(4..6, "net", 0.5..1.0)
+        event(7, _, 0.9..1.0)
+        event(_, "gpu", _)
+    )");
+    rt::registry reg;
+    reg.add<event_t>("event");
+    rt::matcher m(prog.view(), reg);
+    measure("runtime matcher", 2000000, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i) r += m.first(evs[i & 4095]) + 1;
+        sink_ = r;
+    });
+}
+
+/*
+ * The start-up of a matcher with a large rule set: compiling the rule texts,
+ * against checking a saved image of the compiled program, mapped from a file.
+ * The file stays in the page cache between the rounds, so the disk isn't measured.
+*/
+
+void bench_image(void)
+{
+    using namespace match;
+    std::cout << "image (20000 rules, per start-up):" << std::endl;
+    const char* topics[] = { "disk", "net", "cpu", "mem", "gpu" };
+    std::mt19937 rng(7);
+    std::string text;
+    for (size_t i = 0; i < 20000; ++i)
+    {
+        int k = static_cast<int>(rng() % 1000);
+        text += "event(" + std::to_string(k) + ".." + std::to_string(k + rng() % 10) + ", ";
+        if (i % 100 == 0) text += "/" + std::string(topics[rng() % 5]) + "[0-9]*/";
+        else              text += "\"" + std::string(topics[rng() % 5]) + std::to_string(i) + "\"";
+        text += (rng() % 2) ? ", _)\n" : ", 0.5..1.0)\n";
+    }
+    rt::registry reg;
+    reg.add<event_t>("event");
+
+    measure("compile the rule texts", 20, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            auto prog = rt::compile(text);
+            rt::matcher m(prog.view(), reg);
+            r += static_cast<long>(m.size());
+        }
+        sink_ = r;
+    });
+
+    const char* path = "match_bench.img";
+    rt::write_image(path, rt::save_image(rt::compile(text)));
+    measure("map the image", 20, [&](size_t n)
+    {
+        long r = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            rt::image_file f(path);
+            rt::matcher m(f.view(), reg);
+            r += static_cast<long>(m.size());
+        }
+        sink_ = r;
+    });
+    std::remove(path);
+}
+
+/*
+ * The router: publishing & handling on one thread, then the producers & workers in threads.
+ * The producers retry when a queue is full, and the handled messages are checked at the end.
+*/
+
+void bench_router(void)
+{
+    using namespace match;
+    std::cout << "router (" << std::thread::hardware_concurrency() << " hardware threads, per message):" << std::endl;
+    auto evs = make_events(4096);
+
+    auto route = [](router<event_t>& r, std::atomic<long>* counts)
+    {
+        r.on(C<event_t>(Range(1, 3), "disk", _)           , [counts](event_t&) { counts[0].fetch_add(1, std::memory_order_relaxed); });
+        r.on(C<event_t>(Range(4, 6), "net", Range(0.5, 1.0)), [counts](event_t&) { counts[1].fetch_add(1, std::memory_order_relaxed); });
+        r.on(C<event_t>(_, "gpu", _)                       , [counts](event_t&) { counts[2].fetch_add(1, std::memory_order_relaxed); });
+        r.on(_                                             , [counts](event_t&) { counts[3].fetch_add(1, std::memory_order_relaxed); });
+    };
+
+    measure("publish & poll, 1 thread", 1000000, [&](size_t n)
+    {
+        std::atomic<long> counts[4] {};
+        router<event_t> r;
+        route(r, counts);
+        for (size_t i = 0; i < n; ++i)
+        {
+            r.publish(evs[i & 4095]);
+            if ((i & 255) == 255) r.poll();
+        }
+        r.poll();
+        sink_ = counts[0] + counts[1] + counts[2] + counts[3];
+    });
+
+    for (size_t producers : { 1, 2, 4 }) for (size_t workers : { 1, 2 })
+    {
+        std::string name = std::to_string(producers) + " producers, " + std::to_string(workers) + " workers";
+        bool lost = false;
+        measure(name.c_str(), 1000000, [&](size_t n)
+        {
+            std::atomic<long> counts[4] {};
+            router<event_t> r;
+            route(r, counts);
+            r.start(workers);
+            std::vector<std::thread> ps;
+            for (size_t p = 0; p < producers; ++p)
+            {
+                ps.emplace_back([&, p]
+                {
+                    for (size_t i = p; i < n; i += producers)
+                    {
+                        while (!r.publish(evs[i & 4095])) std::this_thread::yield();
+                    }
+                });
+            }
+            for (auto& t : ps) t.join();
+            r.stop();
+            long total = counts[0] + counts[1] + counts[2] + counts[3];
+            lost = lost || (total != static_cast<long>(n));
+            sink_ = total;
+        });
+        if (lost) std::cout << "  !! some messages were lost" << std::endl;
+    }
+}
+
+/*
+ * Matching a shared tree of std::shared_ptr nodes from several threads: through the pointers
+ * by reference, against copying them (each copy is an atomic increment & decrement of a count
+ * shared by all the threads).
+*/
+
+struct bnode
+{
+    int                    k_;
+    std::shared_ptr<bnode> l_, r_;
+};
+MATCH_REGIST_TYPE(bnode, int, std::shared_ptr<bnode>, std::shared_ptr<bnode>)
+
+int classify_copy(std::shared_ptr<bnode> n)
+{
+    using namespace match;
+    std::shared_ptr<bnode> l = n->l_;
+    int r = 0;
+    Match(n->k_, l ? l->k_ : -1)
+    {
+        Case(1, 2) r = 1;
+        Case(1, _) r = 2;
+        Case(_, 2) r = 3;
+    }
+    EndMatch
+    return r;
+}
+
+int classify_ref(const std::shared_ptr<bnode>& n)
+{
+    using namespace match;
+    int r = 0;
+    Match(n)
+    {
+        Case(C<bnode>(1, C<bnode>(2, _, _), _)) r = 1;
+        Case(C<bnode>(1, _, _))                 r = 2;
+        Case(C<bnode>(_, C<bnode>(2, _, _), _)) r = 3;
+    }
+    EndMatch
+    return r;
+}
+
+void bench_option(void)
+{
+    std::cout << "option (shared_ptr tree, " << std::thread::hardware_concurrency() << " hardware threads, per match of each thread):" << std::endl;
+    std::mt19937 rng(3);
+    std::vector<std::shared_ptr<bnode>> leaves(16), nodes(1024);
+    for (auto& l : leaves) l = std::make_shared<bnode>(bnode{ static_cast<int>(rng() % 4), nullptr, nullptr });
+    for (auto& n : nodes)
+    {
+        n = std::make_shared<bnode>(bnode{ static_cast<int>(rng() % 4), leaves[rng() % 16], nullptr });
+        if (rng() % 4 == 0) n->l_ = nullptr;
+    }
+
+    for (size_t threads : { 1, 2, 4 })
+    {
+        auto run = [&](int (*classify)(const std::shared_ptr<bnode>&), size_t n)
+        {
+            std::vector<std::thread> ts;
+            std::atomic<long> total { 0 };
+            for (size_t t = 0; t < threads; ++t)
+            {
+                ts.emplace_back([&]
+                {
+                    long sum = 0;
+                    for (size_t i = 0; i < n; ++i) sum += classify(nodes[i & 1023]);
+                    total += sum;
+                });
+            }
+            for (auto& t : ts) t.join();
+            sink_ = total;
+        };
+        std::string suffix = ", " + std::to_string(threads) + " threads";
+        measure(("copying the pointers" + suffix).c_str(), 1000000, [&](size_t n)
+        {
+            run([](const std::shared_ptr<bnode>& p) { return classify_copy(p); }, n);
+        });
+        measure(("through the pointers" + suffix).c_str(), 1000000, [&](size_t n)
+        {
+            run(&classify_ref, n);
+        });
+    }
+}
+
+/*
+ * Type(...) on a sealed hierarchy (the dense class IDs), against the same hierarchy with
+ * the dynamic_casts, on the shapes of random classes.
+*/
+
+struct oshape                 { virtual ~oshape(void) = default; };
+struct ocircle  : oshape      {};
+struct opolygon : oshape      {};
+struct orect    : opolygon    {};
+struct osquare  : orect       {};
+struct otriangle: opolygon    {};
+
+struct sshape                 { MATCH_SEALED_CLASS() virtual ~sshape(void) = default; };
+struct scircle  : sshape      { MATCH_SEALED_CLASS() };
+struct spolygon : sshape      { MATCH_SEALED_CLASS() };
+struct srect    : spolygon    { MATCH_SEALED_CLASS() };
+struct ssquare  : srect       { MATCH_SEALED_CLASS() };
+struct striangle: spolygon    { MATCH_SEALED_CLASS() };
+MATCH_SEALED(sshape, scircle, spolygon, srect, ssquare, striangle)
+
+template <typename S, typename Circle, typename Square, typename Rect, typename Polygon>
+int classify_shape(const S* s)
+{
+    using namespace match;
+    int r = 0;
+    Match(s)
+    {
+        Case(Type(Circle))  r = 1;
+        Case(Type(Square))  r = 2;
+        Case(Type(Rect))    r = 3;
+        Case(Type(Polygon)) r = 4;
+    }
+    EndMatch
+    return r;
+}
+
+template <typename S, typename... C>
+std::vector<std::unique_ptr<S>> make_shapes(size_t n)
+{
+    using maker_t = std::unique_ptr<S> (*)(void);
+    const maker_t makers[] = { []{ return std::unique_ptr<S>(new C); }... };
+    std::mt19937 rng(5);
+    std::vector<std::unique_ptr<S>> v(n);
+    for (auto& p : v) p = makers[rng() % sizeof...(C)]();
+    return v;
+}
+
+void bench_sealed(void)
+{
+    std::cout << "sealed (Type(...) over 5 classes, 4 arms):" << std::endl;
+    auto os = make_shapes<oshape, ocircle, opolygon, orect, osquare, otriangle>(1024);
+    auto ss = make_shapes<sshape, scircle, spolygon, srect, ssquare, striangle>(1024);
+    measure("dynamic_cast", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i) sum += classify_shape<oshape, ocircle, osquare, orect, opolygon>(os[i & 1023].get());
+        sink_ = sum;
+    });
+    measure("sealed class IDs", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i) sum += classify_shape<sshape, scircle, ssquare, srect, spolygon>(ss[i & 1023].get());
+        sink_ = sum;
+    });
+}
+
+/*
+ * The double dispatch of a collision on the dynamic types of both shapes: TypeMatch (the cached
+ * winning arm of each pair of types) against the cascade of the dynamic_casts of a Match.
+*/
+
+template <bool Cached>
+int collide(const oshape* a, const oshape* b);
+
+#define BENCH_COLLIDE_ARMS_                                                   \
+        Case(Type(ocircle)  , Type(ocircle))   r = 1;                         \
+        Case(Type(ocircle)  , Type(orect))     r = 2;                         \
+        Case(Type(ocircle)  , Type(otriangle)) r = 3;                         \
+        Case(Type(orect)    , Type(ocircle))   r = 4;                         \
+        Case(Type(orect)    , Type(orect))     r = 5;                         \
+        Case(Type(orect)    , Type(otriangle)) r = 6;                         \
+        Case(Type(otriangle), Type(ocircle))   r = 7;                         \
+        Case(Type(otriangle), Type(orect))     r = 8;                         \
+        Case(Type(otriangle), Type(otriangle)) r = 9;                         \
+        Case(Type(opolygon) , _)               r = 10;                        \
+        Case(_              , _)               r = 11;
+
+template <>
+int collide<false>(const oshape* a, const oshape* b)
+{
+    using namespace match;
+    int r = 0;
+    Match(a, b)
+    {
+        BENCH_COLLIDE_ARMS_
+    }
+    EndMatch
+    return r;
+}
+
+template <>
+int collide<true>(const oshape* a, const oshape* b)
+{
+    using namespace match;
+    int r = 0;
+    TypeMatch(a, b)
+    {
+        BENCH_COLLIDE_ARMS_
+    }
+    EndMatch
+    return r;
+}
+
+void bench_dispatch(void)
+{
+    std::cout << "dispatch (Match(a, b) on the types of 2 shapes, 11 arms):" << std::endl;
+    auto os = make_shapes<oshape, ocircle, opolygon, orect, osquare, otriangle>(1024);
+    measure("Match, dynamic_casts", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i) sum += collide<false>(os[i & 1023].get(), os[(i * 7 + 3) & 1023].get());
+        sink_ = sum;
+    });
+    measure("TypeMatch, cached by the typeids", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i) sum += collide<true>(os[i & 1023].get(), os[(i * 7 + 3) & 1023].get());
+        sink_ = sum;
+    });
+}
+
+/*
+ * Fanning an event out to all the rules it fires: one match::all() against a when() for each rule,
+ * on the rules of the cheap patterns (events), and of the expensive ones shared by the rules (Types).
+*/
+
+#define BENCH_EVENT_RULES_(F)                                      \
+    F(0, Lit(1)      , C<event_t>(_, "disk", _))                   \
+    F(1, Lit(2)      , C<event_t>(_, "disk", _))                   \
+    F(2, Lit(3)      , C<event_t>(_, "net" , _))                   \
+    F(3, Lit(4)      , C<event_t>(_, "net" , _))                   \
+    F(4, Lit(5)      , _)                                          \
+    F(5, Range(8, 15), C<event_t>(_, "cpu" , _))                   \
+    F(6, _           , C<event_t>(_, "disk", _))                   \
+    F(7, _           , C<event_t>(_, "net" , _))                   \
+    F(8, Range(0, 3) , C<event_t>(_, _, Range(0.9, 1.0)))
+
+#define BENCH_SHAPE_RULES_(F)                                      \
+    F(0, Lit(1)      , Type(ocircle))                              \
+    F(1, Lit(2)      , Type(ocircle))                              \
+    F(2, Lit(3)      , Type(orect))                                \
+    F(3, Lit(4)      , Type(orect))                                \
+    F(4, Lit(5)      , _)                                          \
+    F(5, Range(8, 15), Type(opolygon))                             \
+    F(6, _           , Type(ocircle))                              \
+    F(7, _           , Type(orect))                                \
+    F(8, Range(0, 3) , Type(otriangle))
+
+#define BENCH_ALL_CASE_(N, ...) case_(__VA_ARGS__),
+#define BENCH_ALL_WHEN_(N, ...) fired.set(N, when(k, x)(case_(__VA_ARGS__) >>= true));
+
+void bench_all(void)
+{
+    using namespace match;
+    std::cout << "all (an event against 10 rules):" << std::endl;
+    auto evs = make_events(1024);
+    auto os  = make_shapes<oshape, ocircle, opolygon, orect, osquare, otriangle>(1024);
+    measure("events, a when() for each rule", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const event_t& x = evs[i & 1023];
+            int k = x.kind_;
+            std::bitset<10> fired;
+            BENCH_EVENT_RULES_(BENCH_ALL_WHEN_)
+            fired.set(9);
+            sum += static_cast<long>(fired.count());
+        }
+        sink_ = sum;
+    });
+    measure("events, match::all", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const event_t& x = evs[i & 1023];
+            sum += static_cast<long>(all(x.kind_, x)(BENCH_EVENT_RULES_(BENCH_ALL_CASE_) case_(_, _)).count());
+        }
+        sink_ = sum;
+    });
+    measure("shapes, a when() for each rule", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const oshape* x = os[i & 1023].get();
+            int k = evs[i & 1023].kind_;
+            std::bitset<10> fired;
+            BENCH_SHAPE_RULES_(BENCH_ALL_WHEN_)
+            fired.set(9);
+            sum += static_cast<long>(fired.count());
+        }
+        sink_ = sum;
+    });
+    measure("shapes, match::all", 1000000, [&](size_t n)
+    {
+        long sum = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            const oshape* x = os[i & 1023].get();
+            sum += static_cast<long>(all(evs[i & 1023].kind_, x)(BENCH_SHAPE_RULES_(BENCH_ALL_CASE_) case_(_, _)).count());
+        }
+        sink_ = sum;
+    });
+}
+
+struct bench_entry { const char* name_; void (*run_)(void); };
+
+static const bench_entry benches_[] =
+{
+    { "when"    , &bench_when     },
+    { "batch"   , &bench_batch    },
+    { "memo"    , &bench_memo     },
+    { "runtime" , &bench_runtime  },
+    { "image"   , &bench_image    },
+    { "router"  , &bench_router   },
+    { "option"  , &bench_option   },
+    { "sealed"  , &bench_sealed   },
+    { "dispatch", &bench_dispatch },
+    { "all"     , &bench_all      },
+};
+
+int main(int argc, char* argv[])
+{
+    for (auto& b : benches_)
+    {
+        bool run = (argc < 2);
+        for (int i = 1; i < argc; ++i) run = run || (std::strcmp(argv[i], b.name_) == 0);
+        if (run) b.run_();
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+
+    The compile-time benchmark: compile_bench [include-dir]
+    It generates translation units of growing numbers of registered types, fields and arms,
+    and measures the time & the peak memory of compiling each one with $CX (g++ by default).
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+struct scenario
+{
+    const char* name_;
+    bool        regex_;  // includes match/regex.hpp
+    int         types_;  // registered types, each one with a match
+    int         fields_; // of each type
+    int         arms_;   // of each match
+};
+
+static const scenario scenarios_[] =
+{
+    { "match.hpp only"               , false,   0,  0,   0 },
+    { "match.hpp + match/regex.hpp"  , true ,   0,  0,   0 },
+    { "1 type, 4 fields, 8 arms"     , false,   1,  4,   8 },
+    { "1 type, 16 fields, 8 arms"    , false,   1, 16,   8 },
+    { "1 type, 64 fields, 8 arms"    , false,   1, 64,   8 },
+    { "1 type, 16 fields, 32 arms"   , false,   1, 16,  32 },
+    { "1 type, 16 fields, 128 arms"  , false,   1, 16, 128 },
+    { "32 types, 16 fields, 8 arms"  , false,  32, 16,   8 },
+    { "128 types, 16 fields, 1 arm"  , false, 128, 16,   1 },
+};
+
+std::string generate(const scenario& s)
+{
+    static const char* kinds[] = { "int", "double", "char", "long" };
+    std::ostringstream os;
+    os << "#include \"match.hpp\"\n";
+    if (s.regex_) os << "#include \"match/regex.hpp\"\n";
+    for (int t = 0; t < s.types_; ++t)
+    {
+        os << "struct rec" << t << " {";
+        for (int f = 0; f < s.fields_; ++f) os << " " << kinds[f % 4] << " f" << f << "_;";
+        os << " };\nMATCH_REGIST_TYPE(rec" << t;
+        for (int f = 0; f < s.fields_; ++f) os << ", " << kinds[f % 4];
+        os << ")\nint classify" << t << "(const rec" << t << "& r)\n{\n"
+           << "    using namespace match;\n    int k = -1;\n    Match(r)\n    {\n";
+        for (int a = 0; a < s.arms_; ++a)
+        {
+            os << "        Case(C<rec" << t << ">(";
+            for (int f = 0; f < s.fields_; ++f)
+            {
+                if (f != 0) os << ", ";
+                if (f == a % s.fields_) os << (a % 100);
+                else                    os << "_";
+            }
+            os << ")) k = " << a << ";\n";
+        }
+        os << "    }\n    EndMatch\n    return k;\n}\n";
+    }
+    return os.str();
+}
+
+// Runs a command by the shell, and gives its peak memory (in KB), or -1 if it failed.
+
+long run(const std::string& cmd)
+{
+    pid_t pid = ::fork();
+    if (pid < 0) return -1;
+    if (pid == 0)
+    {
+        ::execl("/bin/sh", "sh", "-c", cmd.c_str(), static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    int status = 0;
+    struct rusage ru {};
+    if (::wait4(pid, &status, 0, &ru) < 0) return -1;
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) return -1;
+    return ru.ru_maxrss;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* cx  = std::getenv("CX");
+    std::string inc = (argc > 1) ? argv[1] : ".";
+    std::string src = "./build/compile_bench_tu.cpp";
+    std::string cmd = std::string((cx != nullptr) ? cx : "g++") +
+                      " -std=c++1y -O2 -c -o /dev/null -I\"" + inc + "\" " + src + " 2>/dev/null";
+
+    std::cout << "compile time (" << cmd.substr(0, cmd.find(' ')) << ", includes from " << inc << "):" << std::endl;
+    for (auto& s : scenarios_)
+    {
+        {
+            std::ofstream out(src);
+            out << generate(s);
+        }
+        using clock_t = std::chrono::steady_clock;
+        auto t0 = clock_t::now();
+        long kb = run(cmd);
+        auto t1 = clock_t::now();
+        std::cout << "  " << std::left << std::setw(32) << s.name_ << std::right;
+        if (kb < 0)
+        {
+            std::cout << "    failed" << std::endl;
+            continue;
+        }
+        std::cout << std::setw(8) << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<double>(t1 - t0).count() << " s"
+                  << std::setw(8) << (kb / 1024) << " MB" << std::endl;
+    }
+    std::remove(src.c_str());
+    return 0;
+}
@@ -43,6 +43,21 @@ void test_constant_variable(void)
         EndMatch
     };
     std::cout << fac(10) << " " << fac(-10) << std::endl;
+
+    // a variable binds a copy of a temporary, which every later arm still sees
+    std::string s;
+    Match(std::string("a string too long to be kept in place"))
+    {
+        Case("zzz") std::cout << "zzz" << std::endl;
+        Case(s)     std::cout << "bound: " << s << std::endl;
+    }
+    EndMatch
+    Match(std::string("another string too long to be kept in place"))
+    {
+        With(P(s) && (s.size() < 10))                         std::cout << "short: " << s << std::endl;
+        Case("another string too long to be kept in place")   std::cout << "still there" << std::endl;
+    }
+    EndMatch
 }
 
 void test_predicate(void)
@@ -59,6 +74,8 @@ void test_predicate(void)
     EndMatch
 }
 
+#include "match/regex.hpp"
+
 void test_regex(void)
 {
     TEST_CASE_();
@@ -106,6 +123,64 @@ void test_type(void)
     EndMatch
 }
 
+/*
+ * A sealed hierarchy, whose Type(...) tests the dense class IDs rather than a dynamic_cast.
+*/
+
+struct shape                { MATCH_SEALED_CLASS() virtual ~shape(void) = default; };
+struct circle  : shape      { MATCH_SEALED_CLASS() };
+struct polygon : shape      { MATCH_SEALED_CLASS() };
+struct rect    : polygon    { MATCH_SEALED_CLASS() };
+struct square  : rect       { MATCH_SEALED_CLASS() };
+struct triangle: polygon    { MATCH_SEALED_CLASS() };
+MATCH_SEALED(shape, circle, polygon, rect, square, triangle)
+
+static_assert((match::sealed_class<polygon>::id == 2) && (match::sealed_class<polygon>::last == 5), 
+              "A class & its subclasses should be numbered in a range.");
+
+void test_sealed(void)
+{
+    TEST_CASE_();
+
+    square sq; triangle tr; circle ci;
+    for (shape* sh : { static_cast<shape*>(&sq), static_cast<shape*>(&tr), static_cast<shape*>(&ci) })
+    {
+        Match(sh)
+        {
+            Case(Type(rect))    std::cout << "a rect (id " << sh->match_class_id() << ")" << std::endl;
+            Case(Type(polygon)) std::cout << "another polygon (id " << sh->match_class_id() << ")" << std::endl;
+            Otherwise()         std::cout << "not a polygon (id " << sh->match_class_id() << ")" << std::endl;
+        }
+        EndMatch
+    }
+}
+
+void test_type_match(void)
+{
+    TEST_CASE_();
+
+    Bar<1> b1; Bar<2> b2; Bar<3> b3;
+    Foo* foos[] = { &b1, &b2, &b3 };
+    bool strict = true;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (Foo* x : foos) for (Foo* y : foos)
+        {
+            TypeMatch(x, y)
+            {
+                Case(Type(Bar<1>), Type(Bar<1>))             std::cout << "11 ";
+                Case(Type(Bar<1>), _)                        std::cout << "1_ ";
+                With(P(Type(Bar<2>), Type(Bar<3>)) && strict) std::cout << "23 ";
+                Case(Type(Bar<2>), _)                        std::cout << "2_ ";
+                Otherwise()                                  std::cout << "__ ";
+            }
+            EndMatch
+        }
+        std::cout << std::endl;
+        strict = false;
+    }
+}
+
 struct xx_t
 {
     int    a_ = 2;
@@ -115,6 +190,10 @@ struct xx_t
 };
 MATCH_REGIST_TYPE(xx_t, int, double, xx_t*, Foo)
 
+struct mixed_t { char a_; double b_; char c_; int d_; };
+static_assert((match::layout<char, double, char, int>::offset(1) == offsetof(mixed_t, b_)) && 
+              (match::layout<char, double, char, int>::offset(3) == offsetof(mixed_t, d_)), "The offsets should be the ones of a struct.");
+
 struct node
 {
     std::string v_;
@@ -153,7 +232,163 @@ void test_constructor(void)
     tr.destroy();
 }
 
+// The case tables made at compile time, which take no storage for the stateless patterns.
+
+void test_constexpr(void)
+{
+    TEST_CASE_();
+
+    static constexpr auto left_child = C<tree>(C<node*>("root", C<node*>("left", _, _), _));
+    static constexpr auto right_leaf = C<tree>(C<node*>(_, _, C<node*>(_, nullptr, nullptr)));
+    static_assert(sizeof(C<node*>(_, Type(node*), _)) == 1, "The stateless patterns should take no storage.");
+    static_assert(sizeof(C<tree>(C<node*>(_, _, C<node*>(_, _, _)))) == 1, "The nested stateless patterns too.");
+    static_assert(sizeof(S(Lit(1), _, Lit('x'))) == 1, "The literals too.");
+
+    tree trees[] = 
+    {
+        { new node{ "root", new node{ "left", nullptr, nullptr }, new node{ "right", nullptr, nullptr } } },
+        { new node{ "root", new node{ "x"   , nullptr, nullptr }, new node{ "right", nullptr, nullptr } } }
+    };
+    for (auto& tr : trees)
+    {
+        Match(tr)
+        {
+            Case(left_child) std::cout << "has a left child" << std::endl;
+            Case(right_leaf) std::cout << "has a right leaf" << std::endl;
+        }
+        EndMatch
+        tr.destroy();
+    }
+}
+
+/*
+ * The smart pointers, pointers & optionals, matched through by reference.
+*/
+
+#include <memory>
+#if __cplusplus >= 201703L
+#include <optional>
+#endif
+
+struct snode
+{
+    int                    v_;
+    std::shared_ptr<snode> l_, r_;
+};
+MATCH_REGIST_TYPE(snode, int, std::shared_ptr<snode>, std::shared_ptr<snode>)
+
+void test_option(void)
+{
+    TEST_CASE_();
+
+    auto leaf = std::make_shared<snode>(snode{ 2, nullptr, nullptr });
+    auto root = std::make_shared<snode>(snode{ 1, leaf, nullptr });
+    int v = 0;
+    Match(root)
+    {
+        Case(None)                                       std::cout << "empty" << std::endl;
+        Case(C<snode>(1, C<snode>(v, None, None), None)) std::cout << "a left leaf: " << v << std::endl;
+    }
+    EndMatch
+    std::cout << "use counts (no copies) ->: " << root.use_count() << " " << leaf.use_count() << std::endl;
+
+    std::unique_ptr<snode> up(new snode{ 3, nullptr, nullptr });
+    std::shared_ptr<snode> sp;
+    node* np = nullptr;
+    Match(up, sp, np)
+    {
+        Case(Some(C<snode>(3, _, _)), Some(_), _) std::cout << "all set" << std::endl;
+        Case(Some(C<snode>(v, _, _)), None, C<node*>(_, _, _)) std::cout << "never" << std::endl;
+        Case(Some(C<snode>(v, _, _)), None, None) std::cout << "unique: " << v << ", the others are null" << std::endl;
+    }
+    EndMatch
+
+#if __cplusplus >= 201703L
+    for (std::optional<int> opt : { std::optional<int>{ 42 }, std::optional<int>{} })
+    {
+        Match(opt)
+        {
+            Case(Some(v)) std::cout << "optional: " << v << std::endl;
+            Case(None)    std::cout << "optional: none" << std::endl;
+        }
+        EndMatch
+    }
+#endif
+}
+
+/*
+ * The tuple-like types & (C++17) the aggregates, taken apart without a registration.
+*/
+
+#include <tuple>
+#include <array>
+
+struct big_t
+{
+    static int copies_;
+    int id_;
+    char pad_[256];
+
+    big_t(int id) : id_(id) {}
+    big_t(const big_t& b) : id_(b.id_) { ++copies_; }
+};
+int big_t::copies_ = 0;
+
+#if __cplusplus >= 201703L
+struct pixel
+{
+    int         x_, y_;
+    std::string color_;
+};
+#endif
+
+void test_destructure(void)
+{
+    TEST_CASE_();
+
+    using entry_t = std::pair<std::string, big_t>;
+    entry_t pr { "key", big_t{ 7 } };
+    big_t::copies_ = 0;
+    Match(pr)
+    {
+        Case(C<>("nil", _))        std::cout << "never" << std::endl;
+        Case(C<entry_t>("key", _)) std::cout << "pair: key, " << pr.second.id_ << std::endl;
+    }
+    EndMatch
+    std::cout << "copies of big_t ->: " << big_t::copies_ << std::endl;
+
+    auto tp = std::make_tuple(1, 'x', std::string("tuple"));
+    std::string str;
+    int id = 0;
+    Match(tp)
+    {
+        Case(C<>(1, 'y', _))   std::cout << "never" << std::endl;
+        Case(C<>(1, 'x', str)) std::cout << "tuple: " << str << std::endl;
+    }
+    EndMatch
+
+    std::array<int, 3> ar = {{ 1, 2, 3 }};
+    std::array<int, 3>* ap = &ar;
+    Match(ap)
+    {
+        Case(C<>(_, 2, id)) std::cout << "array: " << id << std::endl;
+    }
+    EndMatch
+
+#if __cplusplus >= 201703L
+    pixel px { 3, 4, "red" };
+    int x = 0;
+    Match(px)
+    {
+        Case(C<pixel>(0, 0, _))     std::cout << "origin" << std::endl;
+        Case(C<pixel>(x, 4, "red")) std::cout << "aggregate: " << x << std::endl;
+    }
+    EndMatch
+#endif
+}
+
 #include <list>
+
 void test_sequence(void)
 {
     TEST_CASE_();
@@ -177,6 +412,128 @@ void test_sequence(void)
     EndMatch
 }
 
+#include <cmath>
+void test_range_in(void)
+{
+    TEST_CASE_();
+
+    auto classify = [](int x)
+    {
+        std::cout << x << " ->: ";
+        Match(x)
+        {
+            Case(Range(0, 9))                std::cout << "digit"     << std::endl;
+            Case(In(10, 20, 30, 40))         std::cout << "round"     << std::endl;
+            Case(In(-7, 1000, 77777, 12345)) std::cout << "scattered" << std::endl;
+            Otherwise()                      std::cout << "Otherwise..." << std::endl;
+        }
+        EndMatch
+    };
+    classify(5);
+    classify(-5);
+    classify(30);
+    classify(77777);
+    classify(31);
+
+    std::list<int> ll = { 1, 2, 3 };
+    xx_t xx;
+    Match(ll, xx)
+    {
+        Case(S(Range(0, 1), In(2, 4), _), C<xx_t>(In(1, 2), Range(0.5, 1.5), _, _))
+            std::cout << "{ 1, 2, 3 } & xx matchs: " << "(Range(0, 1), In(2, 4), _)" << std::endl;
+    }
+    EndMatch
+
+    // an integral target is compared by its value, whatever its type
+    static_assert(!In(-1, 0, 1)(0xFFFFFFFFu) && In(-1, 0, 1)(0u) && !In(1, 2)(0x100000001ull), "");
+    static_assert(In(90, 10, 80, 20, 70, 30, 60, 40, 50, -100)(-100) && !In(90, 10, 80, 20, 70, 30, 60, 40, 50, -100)(4294967196u), "");
+
+    // a reversed range is empty, and NaN is in no range
+    Match(10, std::nan(""))
+    {
+        Case(Range(5, 1), _)       std::cout << "in a reversed range" << std::endl;
+        Case(_, Range(-1e9, 1e9))  std::cout << "NaN in a range" << std::endl;
+        Otherwise()                std::cout << "Otherwise..." << std::endl;
+    }
+    EndMatch
+}
+
+void test_bits(void)
+{
+    TEST_CASE_();
+
+    unsigned status = 0x8A; // 1000_1010
+    Match(status)
+    {
+        Case(Bits("1x0x_1xxx")) std::cout << "bits 7 & 3 set, bit 5 & 2 clear" << std::endl;
+        Case(Bits(0x80, 0x80))  std::cout << "bit 7 set" << std::endl;
+        Otherwise()             std::cout << "Otherwise..." << std::endl;
+    }
+    EndMatch
+
+    // the template strings are checked: a typo or more than 64 bits isn't a constant expression
+    static_assert((Bits("1x0x_1xxx").value_ == 0x88) && (Bits("1x0x_1xxx").mask_ == 0xA8), "");
+    static_assert(Bits("1xxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxx1").mask_ == 0x8000000000000001ull, "");
+    try { Bits("1x0y"); }
+    catch (const std::invalid_argument& e) { std::cout << e.what() << std::endl; }
+    try { Bits("1xxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'xxxxxxxx'1"); }
+    catch (const std::invalid_argument& e) { std::cout << e.what() << std::endl; }
+
+    static const auto decode = Decode(Bits("1xx1_xxxx"), Bits("1xxx_x01x"), Bits("0xxx_xxx1"), Bits("xxxx_xxxx"));
+    for (unsigned word : { 0x90u, 0x82u, 0x01u, 0x00u })
+    {
+        std::cout << std::hex << word << std::dec << " ->: ";
+        Match(decode(word))
+        {
+            Case(0) std::cout << "arm 0" << std::endl;
+            Case(1) std::cout << "arm 1" << std::endl;
+            Case(2) std::cout << "arm 2" << std::endl;
+            Case(3) std::cout << "arm 3" << std::endl;
+        }
+        EndMatch
+    }
+}
+
+#include <vector>
+void test_binary(void)
+{
+    TEST_CASE_();
+
+    // version:4 = 2, kind:4, magic:16 = 0xCAFE, id:32 (little-endian), 2-byte length-prefixed payload, tail
+    std::vector<std::uint8_t> pkt = { 0x25, 0xCA, 0xFE, 0x78, 0x56, 0x34, 0x12, 0x00, 0x03, 'a', 'b', 'c', 0xFF };
+    unsigned kind; std::uint32_t id; bytes payload, tail;
+    Match(pkt)
+    {
+        Case(Bin(be<4>(1), be<4>(kind), be<16>(0xCAFE), rest()))
+            std::cout << "version 1, kind " << kind << std::endl;
+        Case(Bin(be<4>(2), be<4>(kind), be<16>(0xBEEF), rest()))
+            std::cout << "bad magic" << std::endl;
+        Case(Bin(be<4>(2), be<4>(kind), be<16>(0xCAFE), le<32>(id), slice<2>(payload), rest(tail)))
+            std::cout << "version 2, kind " << kind << ", id 0x" << std::hex << id << std::dec 
+                      << ", payload " << std::string(payload.begin(), payload.end()) 
+                      << ", tail " << tail.size() << " byte(s)" << std::endl;
+    }
+    EndMatch
+
+    bytes hdr(pkt.data(), 3);
+    Match(hdr)
+    {
+        Case(Bin(be<8>(0x25), be<16>(0xCAFE)))             std::cout << "exact header" << std::endl;
+        Otherwise()                                        std::cout << "Otherwise..." << std::endl;
+    }
+    EndMatch
+
+    // a little-endian field must be byte aligned, whether it's folded or not
+    std::uint8_t mid;
+    Match(hdr)
+    {
+        Case(Bin(be<4>(2), le<8>(0x5C), be<12>(0xAFE)))    std::cout << "folded misaligned" << std::endl;
+        Case(Bin(be<4>(2), le<8>(mid), be<12>(0xAFE)))    std::cout << "misaligned" << std::endl;
+        Otherwise()                                        std::cout << "Otherwise..." << std::endl;
+    }
+    EndMatch
+}
+
 void test_or_and_guard(void)
 {
     TEST_CASE_();
@@ -231,15 +588,648 @@ void test_or_and_guard(void)
     EndMatch
 }
 
+// The shared sub-trees of a hash-consed expression, matched again and again.
+
+struct expr
+{
+    char  op_;
+    expr* l_;
+    expr* r_;
+};
+MATCH_REGIST_TYPE(expr, char, expr*, expr*)
+
+static int expr_tests_ = 0;
+
+const char* simplify(const expr* e)
+{
+    using namespace match;
+    const char* r = "keep";
+    expr* x = nullptr;
+    MemoMatch(e, *e)
+    {
+        Case(C<expr>('*', _, [](const expr* z) { ++expr_tests_; return z && (z->op_ == '0'); })) r = "zero";
+        Case(C<expr>('+', x, x))                                                               r = "double";
+    }
+    EndMatch
+    return r;
+}
+
+void test_memo_match(void)
+{
+    TEST_CASE_();
+
+    memo_clear();
+    expr zero = { '0', nullptr, nullptr }, one = { '1', nullptr, nullptr };
+    expr mul  = { '*', &one, &zero }, add = { '+', &one, &one }, sub = { '-', &one, &zero };
+    for (int i = 0; i < 3; ++i)
+    {
+        std::cout << "round " << i << " ->: " << simplify(&mul) << " " << simplify(&add) << " " 
+                  << simplify(&sub) << " (" << expr_tests_ << " tests)" << std::endl;
+    }
+    auto s = memo_statistics();
+    std::cout << "hits: " << s.hits_ << ", misses: " << s.misses_ << std::endl;
+
+    // A plain guard is evaluated again on a hit, and the arms after it are tested when it fails.
+    std::cout << "guarded ->:";
+    for (bool flag : { true, false, true, false, false })
+    {
+        MemoMatch(&one, one)
+        {
+            With(P(_) && flag)       std::cout << " 1";
+            Case(C<expr>('1', _, _)) std::cout << " 2";
+            Otherwise()              std::cout << " _";
+        }
+        EndMatch
+    }
+    std::cout << std::endl;
+}
+
+void test_cost_order(void)
+{
+    TEST_CASE_();
+
+    // The columns of Case(Regex(str), 42, a, C<xx_t>(_, _, _, _), _): 
+    // the pure ones go cheapest first, and the binding one goes last.
+    auto column = &cost_column<regex, constant<int>, variable<int>, constructor<xx_t, const wildcard&>, wildcard>;
+    static_assert(cost_column<regex, constant<int>, variable<int>, constructor<xx_t, const wildcard&>, wildcard>(0) == 4, "");
+    static_assert(cost_column<regex, constant<int>, variable<int>, constructor<xx_t, const wildcard&>, wildcard>(4) == 2, "");
+    std::cout << "by cost: ";
+    for (size_t n = 0; n < 5; ++n) std::cout << column(n) << " ";
+    std::cout << "(MATCH_COST_ORDER = " << MATCH_COST_ORDER << ")" << std::endl;
+
+    // The arms overlap: whatever the order of the columns, the first matching arm wins,
+    // only the predicate is skipped more often when the constants go first.
+    int calls = 0, a = 0;
+    auto positive = [&calls](int x) { ++calls; return x > 0; };
+    std::pair<int, const char*> ts[] = { { 1, "a" }, { 1, "c" }, { 5, "b" } };
+    for (auto& t : ts)
+    {
+        Match(t.first, std::string(t.second))
+        {
+            Case(positive, "b") std::cout << "arm 1, ";
+            Case(a, "a")        std::cout << "arm 2 (a = " << a << "), ";
+            Case(1, _)          std::cout << "arm 3, ";
+        }
+        EndMatch
+    }
+    std::cout << calls << " predicate call(s) (MATCH_COST_ORDER = " << MATCH_COST_ORDER << ")" << std::endl;
+}
+
+void test_when(void)
+{
+    TEST_CASE_();
+
+    // Pure & cheap arms: evaluated together, and the result is selected without branches.
+    auto grade = [](int score)
+    {
+        return when(score)(case_(100)           >>= 'S', 
+                           case_(Range(90, 99)) >>= 'A', 
+                           case_(Range(60, 89)) >>= 'B', 
+                           case_(_)             >>= 'F');
+    };
+    std::cout << "grades ->: " << grade(100) << grade(95) << grade(60) << grade(12) << std::endl;
+
+    // The arms bind variables: tested in order, and only the chosen result is called.
+    std::string s = "hello";
+    int v = 0;
+    auto r = when(s, 21)(case_("hi"   , _) >>= 0.5, 
+                         case_("hello", v) >>= [&] { return v * 2; });
+    std::cout << "(hello, 21) ->: " << r << std::endl;
+    auto n = when(7)(case_(1) >>= 1L, case_(2) >>= 2);
+    std::cout << "(7) ->: " << n << " (no match)" << std::endl;
+
+    // every arm sees the temporary target as it was
+    auto t = when(std::string("a string too long to be kept in place"))(case_("zzz") >>= 1, case_(s) >>= 2);
+    std::cout << "(temporary) ->: " << t << ", " << s << std::endl;
+}
+
+/*
+ * The lookup tables computed at compile time by when().
+*/
+
+#include <array>
+
+constexpr char char_class(char c)
+{
+    using namespace match;
+    return when(c)(case_(Range('0', '9'))      >>= 'd', 
+                   case_(Range('a', 'z'))      >>= 'l', 
+                   case_(Range('A', 'Z'))      >>= 'u', 
+                   case_(In(' ', '\t', '\n')) >>= 's', 
+                   case_(_)                    >>= '.');
+}
+
+struct char_table
+{
+    char cls_[128];
+};
+
+constexpr char_table make_char_table(void)
+{
+    char_table t {};
+    for (int i = 0; i < 128; ++i) t.cls_[i] = char_class(static_cast<char>(i));
+    return t;
+}
+
+static constexpr char_table char_classes = make_char_table();
+static_assert((char_classes.cls_['7'] == 'd') && (char_classes.cls_['Q'] == 'u') && 
+              (char_classes.cls_['\t'] == 's') && (char_classes.cls_['+'] == '.'), "The table should be built at compile time.");
+
+struct insn
+{
+    unsigned char op_;
+    unsigned char size_;
+};
+MATCH_REGIST_MEMBERS(insn, op_, size_)
+
+constexpr int insn_kind(const insn& i)
+{
+    using namespace match;
+    return when(i)(case_(C<insn>(0x90, _))              >>= 0, // nop
+                   case_(C<insn>(Range(0x70, 0x7f), 2)) >>= 1, // short jump
+                   case_(C<insn>(_, Range(5, 15)))      >>= 2, // long one
+                   case_(_)                             >>= 3);
+}
+
+static_assert((insn_kind({ 0x90, 1 }) == 0) && (insn_kind({ 0x74, 2 }) == 1) && 
+              (insn_kind({ 0xe8, 5 }) == 2) && (insn_kind({ 0x01, 2 }) == 3), "The registered aggregates too.");
+
+constexpr std::array<int, 3> triple = {{ 1, 2, 3 }};
+static_assert( match::when(triple)(match::case_(match::S(1, match::_, 3))                    >>= true, 
+                                   match::case_(match::_) >>= false), "The sequences on std::array too.");
+static_assert(!match::when(triple)(match::case_(match::S(match::_, match::_, match::_, match::_)) >>= true, 
+                                   match::case_(match::_) >>= false), "A longer sequence doesn't match.");
+
+void test_constexpr_when(void)
+{
+    TEST_CASE_();
+
+    std::cout << "\"a1 B+\" ->: ";
+    for (char c : std::string("a1 B+")) std::cout << char_classes.cls_[static_cast<int>(c)];
+    std::cout << std::endl;
+    insn code[] = { { 0x90, 1 }, { 0x74, 2 }, { 0xe8, 5 }, { 0x01, 2 } };
+    std::cout << "instructions ->: ";
+    for (auto& i : code) std::cout << insn_kind(i) << " ";
+    std::cout << std::endl;
+}
+
+#include "match/batch.hpp"
+
+void test_batch(void)
+{
+    TEST_CASE_();
+
+    auto table = batch<float>(case_(0.f), case_(Range(0.0, 0.5)), case_(Range(-1.0, 1.0)));
+    float xs[] = { 0.f, 0.25f, -0.75f, 3.f, 0.5f, 1.f, -2.f, 0.f, 0.125f, 2.f };
+    std::uint8_t out[10];
+    for (auto lv : { simd::none, simd::sse2, simd::avx2 })
+    {
+        if (lv > simd_level()) break;
+        table(xs, 10, out, lv);
+        std::cout << "level " << static_cast<int>(lv) << " ->: ";
+        for (auto r : out) std::cout << static_cast<int>(r) << " ";
+        std::cout << std::endl;
+    }
+
+    // as the scalar ranges: a reversed range is empty, and NaN is in no range
+    auto edges = batch<float>(case_(Range(1.0, -1.0)), case_(Range(-1e9, 1e9)), case_(_));
+    float ys[] = { std::nanf(""), 0.5f, 5.f, std::nanf(""), -0.5f, 0.f, 1e10f, std::nanf("") };
+    std::uint8_t res[8];
+    for (auto lv : { simd::none, simd::sse2, simd::avx2 })
+    {
+        if (lv > simd_level()) break;
+        edges(ys, 8, res, lv);
+        std::cout << "level " << static_cast<int>(lv) << " ->: ";
+        for (auto r : res) std::cout << static_cast<int>(r) << " ";
+        std::cout << std::endl;
+    }
+}
+
+#include "match/dnet.hpp"
+
+struct event_t
+{
+    int         kind_;
+    std::string topic_;
+    double      level_;
+};
+MATCH_REGIST_TYPE(event_t, int, std::string, double)
+
+void test_dnet(void)
+{
+    TEST_CASE_();
+
+    dnet<event_t> net;
+    const char* topics[] = { "disk", "net", "cpu", "mem" };
+    for (int i = 0; i < 1000; ++i)
+    {
+        net.add(i % 50, topics[i % 4], _);                    // constants on the kind & topic
+    }
+    net.add(_, "net", [](double x) { return x > 0.9; });      // a residual predicate only
+    net.add(7, _, Range(0.5, 1.0));
+    net.build();
+
+    for (auto& ev : { event_t{ 7, "net", 0.95 }, event_t{ 7, "disk", 0.1 }, event_t{ 99, "gpu", 0.0 } })
+    {
+        size_t checked = net.match(ev, [](size_t) {});
+        auto ids = net.match(ev);
+        std::cout << "(" << ev.kind_ << ", " << ev.topic_ << ", " << ev.level_ << ") ->: " 
+                  << ids.size() << " matched in " << checked << " candidates of " << net.size() << ":";
+        for (size_t i = 0; (i < ids.size()) && (i < 4); ++i) std::cout << " " << ids[i];
+        std::cout << (ids.size() > 4 ? " ..." : "") << std::endl;
+    }
+
+    // a callback may match again (reusing a buffer for the outer candidates)
+    std::vector<std::uint32_t> cands;
+    size_t outer = 0, inner = 0;
+    net.match(event_t{ 7, "net", 0.95 }, [&](size_t)
+    {
+        ++outer;
+        inner += net.match(event_t{ 8, "cpu", 0.0 }).size();
+    }, cands);
+    std::cout << "nested ->: " << outer << " matched, " << inner << " matched inside" << std::endl;
+}
+
+void test_match_all(void)
+{
+    TEST_CASE_();
+
+    for (auto& ev : { event_t{ 1, "disk", 0.9 }, event_t{ 3, "net", 0.2 }, event_t{ 9, "gpu", 0.5 } })
+    {
+        auto fired = all(ev.kind_, ev)(case_(Lit(1), _),
+                                       case_(Lit(2), _),
+                                       case_(Lit(3), C<event_t>(_, "net", _)),
+                                       case_(_     , C<event_t>(_, "net", _)),
+                                       case_(Range(0, 4), C<event_t>(_, _, Range(0.8, 1.0))),
+                                       case_(_     , _));
+        std::cout << "(" << ev.kind_ << ", " << ev.topic_ << ", " << ev.level_ << ") ->: " << fired 
+                  << " (" << fired.count() << " rules fired)" << std::endl;
+    }
+
+    // a binding arm leaves a temporary target as it was for the later arms
+    std::string s;
+    auto fired = all(std::string("a string too long to be kept in place"))(
+                     case_(s), case_("a string too long to be kept in place"), case_(_));
+    std::cout << "(temporary) ->: " << fired << ", " << s << std::endl;
+}
+
+#include "match/runtime.hpp"
+
+enum class color : std::uint8_t { red, blue = 200 };
+
+struct pix
+{
+    color color_;
+};
+MATCH_REGIST_TYPE(pix, color)
+
+void test_runtime(void)
+{
+    TEST_CASE_();
+
+    // The rules could be loaded from a config file.
+    auto prog = rt::compile(R"(
+        # the trees
+        tree(node("root", node(/l\w+/, _, _), null))
+        tree(node("root", node("left", null, null), node(_, null, _)))
+        # the events
+        event(1..9, "disk", _)
+        event(_, /n\w+/, 0.5..1.0)
+        [1, _, 3]
+    )");
+    rt::registry reg;
+    reg.add<tree>("tree").add<node>("node").add<event_t>("event");
+    rt::matcher m(prog.view(), reg);
+
+    tree tr = { new node{ "root", new node{ "left", nullptr, nullptr }, new node{ "right", nullptr, nullptr } } };
+    std::list<int> ll = { 1, 2, 3 };
+    std::cout << "tree ->: rule " << m.first(tr) << std::endl;
+    std::cout << "(7, disk, 0.1) ->: rule " << m.first(event_t{ 7, "disk", 0.1 }) << std::endl;
+    std::cout << "(0, net, 0.7) ->: rule " << m.first(event_t{ 0, "net", 0.7 }) << std::endl;
+    std::cout << "(0, cpu, 0.7) ->: rule " << m.first(event_t{ 0, "cpu", 0.7 }) << std::endl;
+    std::cout << "{ 1, 2, 3 } ->: rule " << m.first(ll) << std::endl;
+    std::cout << "array { 1, 2, 3 } ->: rule " << m.first(std::array<int, 3>{ { 1, 2, 3 } }) << std::endl;
+    tr.destroy();
+
+    try { rt::compile("node(1, 2"); }
+    catch (const rt::parse_error& e) { std::cout << "parse error: " << e.what() << std::endl; }
+    try { rt::compile("9..1"); }
+    catch (const rt::parse_error& e) { std::cout << "parse error: " << e.what() << std::endl; }
+
+    // a reversed range built by hand is empty, as Range(9, 1) is
+    rt::program rev;
+    rev.add(rt::pattern::range(std::int64_t(9), std::int64_t(1)));
+    std::cout << "5 in 9..1 ->: rule " << rt::matcher(rev.view(), reg).first(5) << std::endl;
+
+    // a rule which fails to compile leaves nothing behind
+    rt::pattern deep = rt::pattern::string("deep");
+    for (size_t i = 0; i < rt::max_depth; ++i) deep = rt::pattern::sequence({ deep, rt::pattern::any() });
+    try { rev.add(deep); }
+    catch (const std::length_error& e) { std::cout << "compile error: " << e.what() << std::endl; }
+    try { rt::compile(std::string(100000, '[')); }
+    catch (const std::length_error& e) { std::cout << "parse error: " << e.what() << std::endl; }
+    rev.add(rt::pattern::integer(5));
+    std::cout << "5 ->: rule " << rt::matcher(rev.view(), reg).first(5) << " of " << rev.size() << std::endl;
+
+    // a leading 0 is still decimal, and "0x" is hexadecimal
+    auto nums = rt::compile("010\n0x10..0x1f");
+    rt::matcher mn(nums.view(), reg);
+    std::cout << "8, 10, 16 ->: rules " << mn.first(8) << " " << mn.first(10) << " " << mn.first(16) << std::endl;
+
+    // an enum is read as its underlying type, so an unsigned one is never negative
+    auto pixes = rt::compile("pix(-56)\npix(200)");
+    reg.add<pix>("pix");
+    std::cout << "pix(blue) ->: rule " << rt::matcher(pixes.view(), reg).first(pix{ color::blue }) << std::endl;
+
+    auto unknown = rt::compile("nosuchtype(1)");
+    try { rt::matcher(unknown.view(), reg); }
+    catch (const std::invalid_argument& e) { std::cout << "matcher error: " << e.what() << std::endl; }
+}
+
+#include "match/image.hpp"
+
+void test_image(void)
+{
+    TEST_CASE_();
+
+    // A compiled program could be saved as an image, and used in place (e.g. from a mapped file).
+    auto image = rt::save_image(rt::compile(R"(
+        event(1..9, "disk", _)
+        event(_, /n\w+/, 0.5..1.0)
+    )"));
+    rt::registry reg;
+    reg.add<event_t>("event");
+    rt::matcher m(rt::load_image(image.data(), image.size()), reg);
+    std::cout << "(7, disk, 0.1) ->: rule " << m.first(event_t{ 7, "disk", 0.1 }) << std::endl;
+    std::cout << "(0, net, 0.7) ->: rule " << m.first(event_t{ 0, "net", 0.7 }) << std::endl;
+
+    image[image.size() - 1] ^= 1;
+    try { rt::load_image(image.data(), image.size()); }
+    catch (const rt::image_error& e) { std::cout << "image error: " << e.what() << std::endl; }
+}
+
+#include "match/router.hpp"
+#include <memory>
+
+void test_router(void)
+{
+    TEST_CASE_();
+
+    router<event_t> r;
+    auto disk = r.on(C<event_t>(_, "disk", _), [](event_t& e) { std::cout << "disk: " << e.kind_ << std::endl; });
+    auto high = r.on(C<event_t>(_, _, Range(0.9, 1.0)), [](event_t& e) { std::cout << "high: " << e.topic_ << std::endl; });
+    r.publish(event_t{ 1, "disk", 0.1 });
+    r.publish(event_t{ 2, "net" , 0.95 });
+    r.publish(event_t{ 3, "net" , 0.5 });
+    r.publish(event_t{ 4, "disk", 0.99 });
+    std::cout << "queued: " << r.stat(disk).depth_ << ", " << r.stat(high).depth_ 
+              << ", unrouted: " << r.unrouted() << std::endl;
+    size_t n = r.poll();
+    std::cout << "polled: " << n << std::endl;
+
+    // The pointers are routed by the objects they point to.
+    router<std::unique_ptr<Foo>> rf;
+    long counts[2] = {};
+    rf.on(Type(Bar<1>), [&](std::unique_ptr<Foo>&) { ++counts[0]; });
+    rf.on(_           , [&](std::unique_ptr<Foo>&) { ++counts[1]; });
+    rf.start(2);
+    for (int i = 0; i < 1000; ++i)
+    {
+        if (i % 4) rf.publish(std::unique_ptr<Foo>(new Bar<2>));
+        else       rf.publish(std::unique_ptr<Foo>(new Bar<1>));
+    }
+    rf.stop();
+    std::cout << "Bar<1>: " << counts[0] << ", others: " << counts[1] << ", handled: " 
+              << rf.stat(0).handled_ + rf.stat(1).handled_ << std::endl;
+
+    // a pointer to a derived class is converted once, then tested by each handler
+    router<std::unique_ptr<Foo>> rd;
+    rd.on(Type(Bar<2>), [](std::unique_ptr<Foo>& p) { std::cout << "derived ->: " << (p ? "Bar<2>" : "null") << std::endl; });
+    rd.publish(std::unique_ptr<Bar<2>>(new Bar<2>));
+    rd.poll();
+
+    // a null pointer goes to no handler, not even the wildcard one
+    std::cout << "null ->: " << rf.publish(std::unique_ptr<Foo>()) << ", unrouted: " << rf.unrouted() << std::endl;
+}
+
+// Counts the allocations of the whole program, for checking the hot-path matches.
+
+#include <new>
+#include <cstdlib>
+#include <atomic>
+
+static std::atomic<size_t> allocations_ { 0 };
+
+void* operator new(size_t size)
+{
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// gcc sees the free of a pointer from "new" after inlining, which is right for these replacements.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept            { std::free(p); }
+void operator delete(void* p, size_t) noexcept    { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+void test_hot_match(void)
+{
+    TEST_CASE_();
+
+    Foo* foo = new Bar<1>;
+    square sq;
+    shape* sh = &sq;
+    event_t ev = { 2, "disk", 0.75 };
+    std::list<int> ll = { 1, 2, 3 };
+    std::vector<std::uint8_t> pkt = { 0x25, 0xCA, 0xFE, 0x78 };
+    std::unique_ptr<snode> up(new snode{ 3, nullptr, nullptr });
+    node* np = nullptr;
+    auto pr = std::make_pair(7, std::string("a string too long to be kept in place"));
+    int hits = 0, x = 0;
+    unsigned kind = 0;
+
+    // The whole catalog of the allocation-free patterns, on the hot path: none of them may allocate.
+    auto no_alloc = [](const char* what, size_t before)
+    {
+        size_t allocs = allocations_.load() - before;
+        std::cout << what << ": " << allocs << " allocation(s)" << std::endl;
+        if (allocs != 0) std::abort();
+    };
+    size_t before = allocations_.load();
+    for (int i = 0; i < 100; ++i)
+    {
+        HotMatch(i)
+        {
+            Case(200)                hits += 100;
+            Case(Lit(201))           hits += 100;
+            Case(Range(0, 9))        ++hits;
+            Case(In(10, 20, 30))     ++hits;
+            Case(Bits(0x41, 0x41))   ++hits;
+            Case([](int v) { return v == 50; }) ++hits;
+            With( P(x) && P(Range(90, 99)) )   ++hits;
+            With( !P(Range(0, 98)) || P(_) )   ++hits;
+        }
+        EndMatch
+    }
+    no_alloc("constants, ranges, sets, bits, predicates & variables", before);
+
+    before = allocations_.load();
+    for (int i = 0; i < 100; ++i)
+    {
+        HotMatch(*foo, sh)
+        {
+            Case(Type(Bar<2>), _)          hits += 100;
+            Case(Type(Bar<1>), Type(rect)) ++hits;
+        }
+        EndMatch
+    }
+    no_alloc("types", before);
+
+    before = allocations_.load();
+    for (int i = 0; i < 100; ++i)
+    {
+        HotMatch(ev, ll, pr)
+        {
+            Case(C<event_t>(_, "net", _), _, _)                         hits += 100;
+            Case(C<event_t>(2, "disk", Range(0.5, 1.0)), S(1, _, 4), _) hits += 100;
+            Case(_, S(1, x, 3), C<>(7, "a string too long to be kept in place")) ++hits;
+        }
+        EndMatch
+    }
+    no_alloc("constructors, sequences & tuple-likes", before);
+
+    before = allocations_.load();
+    for (int i = 0; i < 100; ++i)
+    {
+        HotMatch(pkt, up, np)
+        {
+            Case(Bin(be<4>(1), rest()), _, _)                          hits += 100;
+            Case(Bin(be<4>(2), be<4>(kind), rest()), Some(C<snode>(3, None, None)), None) ++hits;
+        }
+        EndMatch
+    }
+    no_alloc("binaries & options", before);
+    std::cout << "hits: " << hits << ", x: " << x << ", kind: " << kind << std::endl;
+    delete foo;
+
+    // A regex allocates whenever it's made, so it's rejected by a HotMatch.
+    std::string s = "aaa";
+    before = allocations_.load();
+    Match(s)
+    {
+        Case(Regex("a+")) ++hits;
+    }
+    EndMatch
+    std::cout << "Regex in a Match ->: allocations: " << (allocations_.load() - before > 0 ? "some" : "none") << std::endl;
+    std::cout << "is_alloc_free<regex>: " << is_alloc_free<regex>::value 
+              << ", is_alloc_free<variable<std::string>>: " << is_alloc_free<variable<std::string>>::value << std::endl;
+}
+
+// A user-defined pattern, which is marked as being worth memoizing.
+
+struct costly_t
+{
+    int v_;
+    static int calls_;
+
+    bool operator()(int x) const
+    {
+        ++calls_;
+        return x == v_;
+    }
+};
+int costly_t::calls_ = 0;
+
+namespace match
+{
+    template <> struct is_pattern <costly_t> : std::true_type {};
+    template <> struct is_memoized<costly_t> : std::true_type {};
+}
+
+inline bool same_pattern(const costly_t& x, const costly_t& y) { return x.v_ == y.v_; }
+
+void test_memoized(void)
+{
+    TEST_CASE_();
+
+    auto detect_zero = [](int x, int y)
+    {
+        costly_t::calls_ = 0;
+        std::cout << "(" << x << ", " << y << ") ->: ";
+        costly_t zero { 0 };
+        Match(x, y)
+        {
+            With( P(costly_t{ 0 }, zero) || P(costly_t{ 0 }, _) || P(_, zero) )
+                std::cout << "Zero found.";
+            Case(zero, _)
+                std::cout << "Unreachable.";
+            Case(_, zero)
+                std::cout << "Unreachable.";
+            Otherwise()
+                std::cout << "Both nonzero.";
+        }
+        EndMatch
+        std::cout << " (" << costly_t::calls_ << " evaluations)" << std::endl;
+    };
+    detect_zero(0, 0);
+    detect_zero(1, 0);
+    detect_zero(0, 10);
+    detect_zero(10, 15);
+}
+
+#if MATCH_PROBES
+void test_probes(void)
+{
+    TEST_CASE_();
+
+    size_t n = 0, ok = 0;
+    for (auto& s : probe_sites())
+    {
+        ++n;
+        if (s.id_ == site_id(s.file_, s.line_)) ++ok;
+    }
+    std::cout << n << " sites, " << ok << " ids of their file:line" << std::endl;
+}
+#endif
+
 int main(void)
 {
     test_constant_variable();
     test_predicate();
     test_regex();
     test_type();
+    test_sealed();
+    test_type_match();
     test_constructor();
     test_sequence();
+    test_constexpr();
+    test_option();
+    test_destructure();
+    test_range_in();
+    test_bits();
+    test_binary();
     test_or_and_guard();
+    test_memoized();
+    test_memo_match();
+    test_hot_match();
+    test_cost_order();
+    test_when();
+    test_constexpr_when();
+    test_batch();
+    test_dnet();
+    test_match_all();
+    test_runtime();
+    test_image();
+    test_router();
+#if MATCH_PROBES
+    test_probes();
+#endif
     std::cout << std::endl;
     return 0;
 }
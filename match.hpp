@@ -8,11 +8,25 @@
 #include "capo/preprocessor.hpp"
 
 #include <utility>     // std::forward
-#include <regex>       // std::regex, std::regex_match
 #include <string>      // std::string
 #include <tuple>       // std::tuple
+#include <array>       // std::array
+#include <bitset>      // std::bitset
+#include <memory>      // std::unique_ptr
 #include <type_traits> // std::add_pointer, std::remove_reference, ...
 #include <cstddef>     // size_t
+#include <cstdint>     // std::uint8_t, std::uint64_t, ...
+#include <limits>      // std::numeric_limits
+#include <stdexcept>   // std::invalid_argument
+#include <cstring>     // std::memcpy, std::memcmp
+#include <atomic>      // std::atomic
+#include <typeinfo>    // typeid
+
+// Set it to 1 for evaluating the columns of a row in the order of their costs (see "pattern_cost").
+
+#ifndef MATCH_COST_ORDER
+#define MATCH_COST_ORDER 0
+#endif
 
 namespace match {
 
@@ -29,6 +43,13 @@ struct is_pattern : std::false_type {};
 template <typename T>
 struct pattern_checker : is_pattern<underlying<T>> {};
 
+// Keeps the forwarding constructors of the patterns from hiding their copy constructors.
+
+template <typename T, typename... U>
+struct is_self : std::false_type {};
+template <typename T, typename U>
+struct is_self<T, U> : std::is_same<T, underlying<U>> {};
+
 /*
  * Constant pattern
 */
@@ -39,7 +60,7 @@ struct constant
     const T& t_;
 
     template <typename U>
-    bool operator()(U&& tar) const
+    constexpr bool operator()(U&& tar) const
     {
         return (std::forward<U>(tar) == t_);
     }
@@ -48,6 +69,25 @@ struct constant
 template <typename T>
 struct is_pattern<constant<T>> : std::true_type {};
 
+/*
+ * Value pattern, a constant pattern holding its own copy of the value.
+*/
+
+template <typename T>
+struct value
+{
+    T t_;
+
+    template <typename U>
+    constexpr bool operator()(U&& tar) const
+    {
+        return (std::forward<U>(tar) == t_);
+    }
+};
+
+template <typename T>
+struct is_pattern<value<T>> : std::true_type {};
+
 /*
  * Variable pattern
 */
@@ -68,6 +108,26 @@ struct variable
 template <typename T>
 struct is_pattern<variable<T>> : std::true_type {};
 
+/*
+ * Literal pattern, a constant pattern whose value is a part of its type, so it takes no storage:
+ * Lit(42), Lit('x'), Lit(color::red)
+*/
+
+template <typename T, T V>
+struct literal
+{
+    template <typename U>
+    constexpr bool operator()(const U& tar) const
+    {
+        return (tar == V);
+    }
+};
+
+template <typename T, T V>
+struct is_pattern<literal<T, V>> : std::true_type {};
+
+#define Lit(...) (match::literal<decltype(__VA_ARGS__), (__VA_ARGS__)> {})
+
 /*
  * Wildcard pattern
 */
@@ -77,7 +137,7 @@ struct wildcard
     constexpr wildcard(void) {}
 
     template <typename U>
-    bool operator()(U&&) const
+    constexpr bool operator()(U&&) const
     {
         return true;
     }
@@ -98,7 +158,7 @@ struct predicate
     F judge_;
 
     template <typename U>
-    bool operator()(U&& tar) const
+    constexpr bool operator()(U&& tar) const
     {
         return !!(this->judge_(std::forward<U>(tar)));
     }
@@ -132,336 +192,2920 @@ inline auto converter(T&& arg)
 }
 
 /*
- * Regular expression pattern
+ * Interval pattern, matches the values in [lo, hi], which is empty when lo > hi (and never has a NaN).
+ * For integers it's a single unsigned subtract-and-compare.
 */
 
-struct regex
+template <typename T>
+struct range
 {
-    std::regex r_;
+    T lo_, hi_;
 
-    template <typename T>
-    regex(T&& r) 
-        : r_(std::forward<T>(r))
-    {}
+    // At least an unsigned int, since the narrower ones would be promoted to int by the subtraction.
+    template <typename U>
+    using unsigned_t = typename std::make_unsigned<typename std::common_type<T, U, int>::type>::type;
 
     template <typename U>
-    bool operator()(U&& tar) const
+    constexpr auto operator()(const U& tar) const
+        -> typename std::enable_if<std::is_integral<T>::value && std::is_integral<U>::value, bool>::type
+    {
+        return (lo_ <= hi_) & ((unsigned_t<U>(tar) - unsigned_t<U>(lo_)) <= (unsigned_t<U>(hi_) - unsigned_t<U>(lo_)));
+    }
+
+    template <typename U>
+    constexpr auto operator()(const U& tar) const
+        -> typename std::enable_if<!std::is_integral<T>::value || !std::is_integral<U>::value, bool>::type
     {
-        return std::regex_match(std::forward<U>(tar), r_);
+        return (lo_ <= tar) & (tar <= hi_);
     }
 };
 
-template <>
-struct is_pattern<regex> : std::true_type{};
+template <typename T>
+struct is_pattern<range<T>> : std::true_type {};
 
-#define Regex(...) match::regex { __VA_ARGS__ }
+template <typename L, typename H>
+constexpr auto Range(L lo, H hi)
+    -> range<typename std::common_type<L, H>::type>
+{
+    return { lo, hi };
+}
 
 /*
- * Type pattern
+ * Set-membership pattern, matches any one of the given values.
+ * Small integers are tested against a bitmask, otherwise a short set is compared all at once
+ * (which could be vectorized), and a long one is sorted when it's made and binary searched,
+ * so a long set is better made once (e.g. as a constexpr) than in a Case.
+ * An integral target is compared by its value: one which the type of the set can't hold matches nothing.
 */
 
-template <typename T> inline const T* addr(const T* t) { return t; }
-template <typename T> inline       T* addr(      T* t) { return t; }
-template <typename T> inline const T* addr(const T& t) { return std::addressof(t); }
-template <typename T> inline       T* addr(      T& t) { return std::addressof(t); }
+template <typename T, typename U>
+constexpr auto holds_value(const U& v)
+    -> typename std::enable_if<std::is_signed<U>::value, bool>::type
+{
+    return (v < 0) ? (std::is_signed<T>::value && (static_cast<std::intmax_t>(v) >= 
+                                                   static_cast<std::intmax_t>(std::numeric_limits<T>::min())))
+                   : (static_cast<std::uintmax_t>(v) <= static_cast<std::uintmax_t>(std::numeric_limits<T>::max()));
+}
 
-template <typename T, bool = std::is_polymorphic<underlying<T>>::value>
-struct type;
+template <typename T, typename U>
+constexpr auto holds_value(const U& v)
+    -> typename std::enable_if<!std::is_signed<U>::value, bool>::type
+{
+    return static_cast<std::uintmax_t>(v) <= static_cast<std::uintmax_t>(std::numeric_limits<T>::max());
+}
 
-template <>
-struct type<wildcard, false>
+template <typename T, size_t N>
+struct in_set
 {
+    enum : size_t { linear_max = 8 };
+
+    T             vs_[N];
+    T             lo_    = T();
+    std::uint64_t mask_  = 0;
+    bool          dense_ = false;
+
+    template <typename... U>
+    constexpr in_set(U... vs)
+        : vs_{ static_cast<T>(vs)... }
+    {
+        if (N > linear_max) for (size_t i = 1; i < N; ++i)   // insertion sort, for the binary search
+        {
+            T v = vs_[i];
+            size_t j = i;
+            for (; (j > 0) && (v < vs_[j - 1]); --j) vs_[j] = vs_[j - 1];
+            vs_[j] = v;
+        }
+        T hi = vs_[0];
+        lo_ = vs_[0];
+        for (size_t i = 1; i < N; ++i)
+        {
+            if (vs_[i] < lo_) lo_ = vs_[i];
+            if (hi < vs_[i])  hi  = vs_[i];
+        }
+        dense_ = std::is_integral<T>::value && (static_cast<std::uint64_t>(hi) - 
+                                                static_cast<std::uint64_t>(lo_) < 64);
+        if (dense_) for (size_t i = 0; i < N; ++i)
+        {
+            mask_ |= std::uint64_t(1) << (static_cast<std::uint64_t>(vs_[i]) - static_cast<std::uint64_t>(lo_));
+        }
+    }
+
     template <typename U>
-    bool operator()(U&&) const
+    constexpr bool find(const U& tar) const
     {
-        return true;
+        if (N <= linear_max)
+        {
+            bool r = false;
+            for (size_t i = 0; i < N; ++i) r |= (vs_[i] == tar);
+            return r;
+        }
+        size_t b = 0, e = N;
+        while (b < e)
+        {
+            size_t m = (b + e) / 2;
+            if (vs_[m] < tar) b = m + 1;
+            else              e = m;
+        }
+        return (b < N) && (vs_[b] == tar);
     }
-};
 
-template <typename T>
-struct type<T, false>
-{
     template <typename U>
-    bool operator()(const volatile U&) const
+    constexpr auto operator()(const U& tar) const
+        -> typename std::enable_if<std::is_integral<T>::value && std::is_integral<U>::value, bool>::type
     {
-        return std::is_same<underlying<T>, U>::value;
+        if (!holds_value<T>(tar)) return false;
+        T t = static_cast<T>(tar);
+        if (dense_)
+        {
+            std::uint64_t i = static_cast<std::uint64_t>(t) - static_cast<std::uint64_t>(lo_);
+            return (i < 64) & static_cast<bool>((mask_ >> (i & 63)) & 1); // no branch
+        }
+        return find(t);
     }
-};
 
-template <typename T>
-struct type<T, true>
-{
     template <typename U>
-    bool operator()(U&& tar) const
+    constexpr auto operator()(const U& tar) const
+        -> typename std::enable_if<!std::is_integral<T>::value || !std::is_integral<U>::value, bool>::type
     {
-        using p_t = underlying<T> const volatile *;
-        return (dynamic_cast<p_t>(addr(tar)) != nullptr);
+        return find(tar);
     }
 };
 
-template <typename T, bool Cond>
-struct is_pattern<type<T, Cond>> : std::true_type{};
+template <typename T, size_t N>
+struct is_pattern<in_set<T, N>> : std::true_type {};
 
-#define Type(...) match::type<__VA_ARGS__> {}
+template <typename... T>
+constexpr auto In(T... vs)
+    -> in_set<typename std::common_type<T...>::type, sizeof...(T)>
+{
+    return { vs... };
+}
 
 /*
- * Constructor pattern
+ * Bitmask pattern, for the flag words: (tar & mask) == value.
+ * The bits could be given by a template string, most significant bit first:
+ * '1' for set, '0' for clear, 'x' for don't care, and '_' or '\'' as separators.
 */
 
-template <typename...>
-struct model;
+struct bits
+{
+    std::uint64_t value_, mask_;
+
+    template <typename U>
+    constexpr bool operator()(const U& tar) const
+    {
+        return (static_cast<std::uint64_t>(tar) & mask_) == value_;
+    }
+};
 
 template <>
-struct model<> {};
-
-template <typename T1, typename... T>
-struct model<T1, T...> : model<T...> { T1 m_; };
-
-template <typename Tp, size_t N>
-struct model_strip;
-template <typename T1, typename... T, size_t N>
-struct model_strip<model<T1, T...>, N> : model_strip<model<T...>, N - 1> {};
-template <typename T1, typename... T>
-struct model_strip<model<T1, T...>, 0> { using type = model<T1, T...>; };
-template <typename Tp>
-struct model_strip<Tp, 0>              { using type = Tp; };
-
-template <typename Tp>
-struct model_length              : std::integral_constant<size_t, 0> {};
-template <typename... T>
-struct model_length<model<T...>> : std::integral_constant<size_t, sizeof...(T)> {};
+struct is_pattern<bits> : std::true_type {};
 
-template <typename T, typename U>
-struct model_append                 { using type = model<T, U>; };
-template <typename... T, typename U>
-struct model_append<model<T...>, U> { using type = model<T..., U>; };
+constexpr bits Bits(std::uint64_t value, std::uint64_t mask)
+{
+    return { value & mask, mask };
+}
 
-template <typename Tp>
-struct model_reverse { using type = Tp; };
-template <typename T1, typename... T>
-struct model_reverse<model<T1, T...>>
+// A bad template string (another character, or more than 64 bits) is a compile-time error
+// in a constant expression, and throws an invalid_argument otherwise.
+
+template <size_t N>
+constexpr bits Bits(const char (&s)[N])
 {
-    using head = typename model_reverse<model<T...>>::type;
-    using type = typename model_append<head, T1>::type;
-};
+    bits r { 0, 0 };
+    size_t n = 0;
+    for (size_t i = 0; (i < N) && (s[i] != '\0'); ++i)
+    {
+        char c = s[i];
+        if ((c == '_') || (c == '\'')) continue;
+        if ((c != '0') && (c != '1') && (c != 'x')) throw std::invalid_argument("Bits: expected '0', '1', 'x', '_' or '\\''.");
+        if (++n > 64)                               throw std::invalid_argument("Bits: more than 64 bits.");
+        r.value_ = (r.value_ << 1) | std::uint64_t(c == '1');
+        r.mask_  = (r.mask_  << 1) | std::uint64_t(c != 'x');
+    }
+    return r;
+}
 
-template <typename... T>
-struct layout
+/*
+ * When all the arms of a match site are bitmask patterns, they could be merged into one decoder.
+ * The bits cared about by any arm are gathered into a key, which indexes a table of the first
+ * matching arm. Decode(...)(tar) returns the index of the first matching arm, or the number of arms.
+ * If the key is wider than KeyBits, the decoder falls back to testing the arms one by one.
+*/
+
+template <size_t N, size_t KeyBits = 10>
+struct bits_decoder
 {
-    using model_t = typename model_reverse<model<T...>>::type;
+    static_assert(KeyBits <= 16, "The key of a bits_decoder is too wide.");
 
-    template <typename U, typename V>
-    struct rep;
-    template <typename U, typename V>
-    struct rep<U&, V>        { using type = V&; };
-    template <typename U, typename V>
-    struct rep<U&&, V>       { using type = V&&; };
-    template <typename U, typename V>
-    struct rep<const U&, V>  { using type = const V&; };
-    template <typename U, typename V>
-    struct rep<const U&&, V> { using type = const V&&; };
+    using index_t = typename std::conditional<(N < 255), std::uint8_t, std::uint16_t>::type;
 
-    template <size_t N, typename U>
-    static auto & get(U&& tar)
+    bits          arms_[N];
+    size_t        runs_ = 0;
+    std::uint64_t run_mask_ [KeyBits + 1] = {}; // the contiguous runs of cared bits
+    size_t        run_shift_[KeyBits + 1] = {};
+    size_t        run_pos_  [KeyBits + 1] = {};
+    bool          lut_ = false;
+    index_t       index_[size_t(1) << KeyBits] = {};
+
+    template <typename... B>
+    constexpr bits_decoder(const B&... arms)
+        : arms_{ arms... }
     {
-        decltype(auto) mm = reinterpret_cast<typename rep<U&&, model_t>::type>(tar);
-        return static_cast<typename model_strip<model_t, model_length<model_t>::value - N - 1>::type &>(mm).m_;
+        std::uint64_t all = 0;
+        for (size_t i = 0; i < N; ++i) all |= arms_[i].mask_;
+        size_t width = 0;
+        for (size_t b = 0; b < 64; )
+        {
+            if (!((all >> b) & 1)) { ++b; continue; }
+            size_t e = b;
+            while ((e < 64) && ((all >> e) & 1)) ++e;
+            if (width + (e - b) > KeyBits) return; // too wide, no table
+            run_mask_ [runs_] = ((e - b == 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << (e - b)) - 1)) << b;
+            run_shift_[runs_] = b;
+            run_pos_  [runs_] = width;
+            ++runs_;
+            width += e - b;
+            b = e;
+        }
+        for (size_t key = 0; key < (size_t(1) << width); ++key)
+        {
+            std::uint64_t word = 0;                 // deposits the key back to its bits
+            for (size_t r = 0; r < runs_; ++r)
+            {
+                word |= (std::uint64_t(key >> run_pos_[r]) << run_shift_[r]) & run_mask_[r];
+            }
+            index_[key] = static_cast<index_t>(scan(word));
+        }
+        lut_ = true;
     }
-};
 
-template <class Bind>
-struct bindings_base
-{
-    template <size_t N, typename T, typename U>
-    static auto apply(const T&, U&&)
-        -> typename std::enable_if<(std::tuple_size<T>::value <= N), bool>::type
+    constexpr size_t scan(std::uint64_t word) const
     {
-        return true;
+        size_t i = 0;
+        while ((i < N) && !arms_[i](word)) ++i;
+        return i;
     }
 
-    template <size_t N, typename T, typename U>
-    static auto apply(const T& tp, U&& tar)
-        -> typename std::enable_if<(std::tuple_size<T>::value > N), bool>::type
+    constexpr size_t key(std::uint64_t word) const
     {
-        using layout_t = typename Bind::layout_t;
-        if ( std::get<N>(tp)(layout_t::template get<N>(tar)) )
+        size_t k = 0;
+        for (size_t r = 0; r < runs_; ++r)
         {
-            return apply<N + 1>(tp, std::forward<U>(tar));
+            k |= static_cast<size_t>((word & run_mask_[r]) >> run_shift_[r]) << run_pos_[r];
         }
-        return false;
-    }
-
-    template <typename T, typename U>
-    static auto apply(const T& tp, U&& tar)
-        -> typename std::enable_if<std::is_pointer<underlying<U>>::value, bool>::type
-    {
-        return apply<0>(tp, *std::forward<U>(tar));
+        return k;
     }
 
-    template <typename T, typename U>
-    static auto apply(const T& tp, U&& tar)
-        -> typename std::enable_if<!std::is_pointer<underlying<U>>::value, bool>::type
+    template <typename U>
+    constexpr int operator()(const U& tar) const
     {
-        return apply<0>(tp, std::forward<U>(tar));
+        auto word = static_cast<std::uint64_t>(tar);
+        return static_cast<int>(lut_ ? index_[key(word)] : scan(word));
     }
 };
 
-template <class C>
-struct bindings;
-
-template <typename C, typename... T>
-struct constructor : type<C>
+template <typename... B>
+constexpr bits_decoder<sizeof...(B)> Decode(const B&... arms)
 {
-    std::tuple<T...> tp_;
+    return { arms... };
+}
 
-    template <typename... U>
-    constructor(U&&... args)
-        : tp_(std::forward<U>(args)...)
-    {}
+/*
+ * Type pattern
+*/
+
+// The smart pointers (std::shared_ptr, std::unique_ptr, ...) are looked through by get(),
+// so neither they are copied, nor their reference counts are touched.
+
+template <typename T, typename = void>
+struct is_smart_pointer : std::false_type {};
+template <typename T>
+struct is_smart_pointer<T, typename std::enable_if<
+    std::is_same<decltype(std::declval<const T&>().get()), typename T::element_type*>::value>::type> : std::true_type {};
+
+template <typename T> inline const T* addr(const T* t) { return t; }
+template <typename T> inline       T* addr(      T* t) { return t; }
+template <typename T> inline auto addr(const T& t) -> typename std::enable_if<!is_smart_pointer<T>::value, const T*>::type { return std::addressof(t); }
+template <typename T> inline auto addr(      T& t) -> typename std::enable_if<!is_smart_pointer<T>::value,       T*>::type { return std::addressof(t); }
+template <typename T> inline auto addr(const T& t) -> typename std::enable_if< is_smart_pointer<T>::value, decltype(t.get())>::type { return t.get(); }
+
+template <typename T, bool = std::is_polymorphic<underlying<T>>::value>
+struct type;
 
+template <>
+struct type<wildcard, false>
+{
     template <typename U>
-    bool operator()(U&& tar) const
+    constexpr bool operator()(U&&) const
     {
-        if ( type<C>::operator()(std::forward<U>(tar)) )
-        {
-            return bindings<underlying<U>>::apply(tp_, std::forward<U>(tar));
-        }
-        return false;
+        return true;
     }
 };
 
-template <typename C, typename... T>
-struct is_pattern<constructor<C, T...>> : std::true_type{};
-
-#define MATCH_REGIST_TYPE(TYPE, ...)                                      \
-    namespace match                                                       \
-    {                                                                     \
-        template <> struct bindings<TYPE> : bindings_base<bindings<TYPE>> \
-        {                                                                 \
-            using layout_t = layout<__VA_ARGS__>;                         \
-        };                                                                \
-        template <> struct bindings<TYPE*> : bindings<TYPE> {};           \
+template <typename T>
+struct type<T, false>
+{
+    template <typename U>
+    constexpr bool operator()(const volatile U&) const
+    {
+        return std::is_same<underlying<T>, U>::value;
     }
+};
 
 /*
- * Sequence pattern
+ * A sealed (closed) hierarchy, whose classes are all listed in pre-order (each one before its subclasses):
+ *  struct shape  { MATCH_SEALED_CLASS() ... };
+ *  struct circle : shape { MATCH_SEALED_CLASS() ... };
+ *  ...
+ *  MATCH_SEALED(shape, circle, polygon, rect, square)
+ *
+ * Each class is given a dense ID, its index in the list, so the IDs of a class & its subclasses are a
+ * range [id, last]. Then a Type(...) of the hierarchy tests the ID of the object by one comparison,
+ * instead of a dynamic_cast (it needs no RTTI). The ID of an object is given by match_class_id(),
+ * which is virtual with MATCH_SEALED_CLASS(). Or the root could store the ID of each object,
+ * e.g. match::sealed_class<circle>::id, give it by a non-virtual match_class_id(),
+ * and list the classes by MATCH_SEALED_IDS().
 */
 
-template <typename... T>
-struct sequence
+template <typename... C>
+struct sealed_hierarchy
 {
-    std::tuple<T...> tp_;
+    enum : unsigned { size = sizeof...(C) };
 
-    template <typename... U>
-    sequence(U&&... args)
-        : tp_(std::forward<U>(args)...)
-    {}
+    template <typename T>
+    static constexpr unsigned id(void)
+    {
+        const bool same[] = { std::is_same<T, C>::value... };
+        unsigned i = 0;
+        while ((i < size) && !same[i]) ++i;
+        return i;
+    }
 
-    template <size_t N, typename U, typename It>
-    auto apply(U&&, It&&) const
-        -> typename std::enable_if<(sizeof...(T) <= N), bool>::type
+    // The subclasses of a class follow it contiguously, so the last one of them ends its range.
+
+    template <typename T>
+    static constexpr unsigned last(void)
+    {
+        const bool derived[] = { std::is_base_of<T, C>::value..., false };
+        unsigned i = id<T>();
+        while (derived[i + 1]) ++i;
+        return i;
+    }
+
+    template <typename T>
+    static constexpr bool is_closed(void)
     {
+        const bool derived[] = { std::is_base_of<T, C>::value... };
+        for (unsigned i = last<T>() + 1; i < size; ++i)
+        {
+            if (derived[i]) return false;
+        }
         return true;
     }
 
-    template <size_t N, typename U, typename It>
-    auto apply(U&& tar, It&& it) const
-        -> typename std::enable_if<(sizeof...(T) > N), bool>::type
+    static constexpr bool is_preorder(void)
     {
-        if ( it == tar.end() )       return false;
-        if ( std::get<N>(tp_)(*it) ) return apply<N + 1>(std::forward<U>(tar), ++it);
-        return false;
+        const bool closed[] = { is_closed<C>()... };
+        for (bool b : closed)
+        {
+            if (!b) return false;
+        }
+        return true;
     }
+};
 
-    template <typename U>
-    bool operator()(U&& tar) const
+template <typename T>
+struct sealed_class : std::false_type {};
+
+template <typename T, typename H, typename R>
+struct sealed_class_of : std::true_type
+{
+    static_assert(H::is_preorder(), "The classes of a sealed hierarchy should be listed in pre-order.");
+    static_assert(std::is_base_of<R, T>::value, "The first class of a sealed hierarchy should be its root.");
+
+    using root_t = R;
+
+    enum : unsigned
     {
-        return apply<0>(std::forward<U>(tar), tar.begin());
+        id   = H::template id  <T>(),
+        last = H::template last<T>()
+    };
+
+    static constexpr bool contains(unsigned i)
+    {
+        return (i - id) <= (last - id);
     }
 };
 
-template <typename... T>
-struct is_pattern<sequence<T...>> : std::true_type{};
+#define MATCH_SEALED_ITEM_(N, ...)                                                        \
+    template <> struct sealed_class<CAPO_PP_A_(N, __VA_ARGS__)>                           \
+        : sealed_class_of<CAPO_PP_A_(N, __VA_ARGS__), sealed_hierarchy<__VA_ARGS__>,      \
+                          CAPO_PP_A_(1, __VA_ARGS__)> {};
 
-/*
- * "filter" is a common function used to provide convenience to the users by converting 
- * constant values into constant patterns and regular variables into variable patterns.
- * If the users defined a suitable converter for a specific type, the filter would choose
- * the custom converter for wrapping that variable of the type.
-*/
+#define MATCH_SEALED_ID_(N, ...)                                                          \
+    inline unsigned CAPO_PP_A_(N, __VA_ARGS__)::match_class_id(void) const                \
+    {                                                                                     \
+        return match::sealed_class<CAPO_PP_A_(N, __VA_ARGS__)>::id;                       \
+    }
 
-void converter(...);
+#define MATCH_SEALED_IDS(...)                                                                                 \
+    namespace match                                                                                           \
+    {                                                                                                         \
+        CAPO_PP_REPEAT_(CAPO_PP_COUNT_(__VA_ARGS__), MATCH_SEALED_ITEM_, __VA_ARGS__)                         \
+    }
 
-template <typename T>
-inline auto filter(T&& arg)
-    -> typename std::enable_if<pattern_checker<T>::value, T&&>::type
-{
-    return std::forward<T>(arg);
-}
+#define MATCH_SEALED(...)                                                                                     \
+    MATCH_SEALED_IDS(__VA_ARGS__)                                                                             \
+    CAPO_PP_REPEAT_(CAPO_PP_COUNT_(__VA_ARGS__), MATCH_SEALED_ID_, __VA_ARGS__)
 
-template <typename T>
-inline auto filter(const T& arg)
-    -> typename std::enable_if<!pattern_checker<T>::value && 
-                                std::is_same<decltype(converter(arg)), void>::value, 
-                                constant<T>>::type
-{
-    return { arg };
-}
+#define MATCH_SEALED_CLASS() public: virtual unsigned match_class_id(void) const;
 
-template <typename T>
-inline auto filter(T& arg)
-    -> typename std::enable_if<!pattern_checker<T>::value && 
-                                std::is_same<decltype(converter(arg)), void>::value, 
-                                variable<T>>::type
-{
-    return { arg };
-}
+template <typename T, typename U>
+struct is_sealed_with : std::integral_constant<bool, sealed_class<T>::value && sealed_class<U>::value> {};
+
+// The class of a target, looked through a pointer or a smart pointer.
+
+template <typename U>
+using class_of = underlying<typename std::remove_pointer<decltype(addr(std::declval<U&>()))>::type>;
 
 template <typename T>
-inline auto filter(T&& arg)
-    -> typename std::enable_if<!pattern_checker<T>::value && 
-                               !std::is_same<decltype(converter(std::forward<T>(arg))), void>::value, 
-                                             decltype(converter(std::forward<T>(arg)))>::type
+struct type<T, true>
+{
+    template <typename U>
+    auto operator()(U&& tar) const
+        -> typename std::enable_if<!is_sealed_with<underlying<T>, class_of<U>>::value, bool>::type
+    {
+        using p_t = underlying<T> const volatile *;
+        return (dynamic_cast<p_t>(addr(tar)) != nullptr);
+    }
+
+    template <typename U>
+    auto operator()(U&& tar) const
+        -> typename std::enable_if<is_sealed_with<underlying<T>, class_of<U>>::value, bool>::type
+    {
+        static_assert(std::is_same<typename sealed_class<underlying<T>>::root_t, typename sealed_class<class_of<U>>::root_t>::value,
+                      "The types should be in the same sealed hierarchy.");
+        auto p = addr(tar);
+        return (p != nullptr) && sealed_class<underlying<T>>::contains(p->match_class_id());
+    }
+};
+
+template <typename T, bool Cond>
+struct is_pattern<type<T, Cond>> : std::true_type{};
+
+#define Type(...) match::type<__VA_ARGS__> {}
+
+/*
+ * The N-th type of a pack, picked by the overload resolution rather than a recursion,
+ * so its instantiation depth doesn't grow with the pack.
+*/
+
+template <size_t N, typename T>
+struct type_at_ { using type = T; };
+
+template <typename Is, typename... T>
+struct type_list_;
+template <size_t... I, typename... T>
+struct type_list_<std::index_sequence<I...>, T...> : type_at_<I, T>... {};
+
+template <size_t N, typename T>
+type_at_<N, T> type_at_select_(const type_at_<N, T>&);
+
+template <size_t N, typename... T>
+using type_at = typename decltype(type_at_select_<N>(std::declval<type_list_<std::index_sequence_for<T...>, T...>>()))::type;
+
+/*
+ * The parts of a composite pattern (a constructor or a sequence pattern), which is derived from them.
+ * The stateless parts (empty and default constructible, as the wildcards, types and literals are)
+ * aren't stored at all, but made again when they are used. So a composite pattern only made of
+ * them is stateless as well, and the nested stateless patterns take no storage.
+*/
+
+template <size_t N, typename T, bool = std::is_empty<T>::value && std::is_default_constructible<T>::value>
+struct pack_item
+{
+    T t_;
+
+    pack_item(void) = default;
+
+    template <typename U>
+    constexpr pack_item(U&& u)
+        : t_(std::forward<U>(u))
+    {}
+
+    constexpr const T& get(void) const { return t_; }
+};
+
+template <size_t N, typename T>
+struct pack_item<N, T, true>
+{
+    constexpr pack_item(void) {}
+
+    template <typename U>
+    constexpr pack_item(U&&) {}
+
+    constexpr T get(void) const { return T{}; }
+};
+
+template <typename Is, typename... T>
+struct pack_base;
+
+template <size_t... I, typename... T>
+struct pack_base<std::index_sequence<I...>, T...> : pack_item<I, T>...
+{
+    pack_base(void) = default;
+
+    template <typename... U>
+    constexpr pack_base(U&&... args)
+        : pack_item<I, T>(std::forward<U>(args))...
+    {}
+};
+
+template <typename... T>
+struct pack : pack_base<std::index_sequence_for<T...>, T...>
+{
+    pack(void) = default;
+
+    template <typename... U, typename = typename std::enable_if<(sizeof...(U) == sizeof...(T)) && 
+                                                                !is_self<pack, U...>::value>::type>
+    constexpr pack(U&&... args)
+        : pack_base<std::index_sequence_for<T...>, T...>(std::forward<U>(args)...)
+    {}
+
+    constexpr const pack& parts(void) const { return *this; }
+};
+
+// Only the stateless composite patterns are default constructible.
+
+template <typename P, typename... U>
+struct is_parts_of : std::integral_constant<bool, !is_self<P, U...>::value && 
+                                                  std::is_constructible<typename P::pack_t, U...>::value> {};
+
+template <size_t N, typename... T>
+constexpr decltype(auto) get(const pack<T...>& p)
+{
+    using item_t = pack_item<N, type_at<N, T...>>;
+    return static_cast<const item_t&>(p).get();
+}
+
+} // namespace match
+
+namespace std
+{
+    template <typename... T>
+    struct tuple_size<match::pack<T...>> : std::integral_constant<size_t, sizeof...(T)> {};
+}
+
+namespace match {
+
+/*
+ * Constructor pattern
+*/
+
+/*
+ * The layout of a registered type, given by the types of its fields in order (MATCH_REGIST_TYPE).
+ * The offsets are computed as a standard-layout struct places its members.
+*/
+
+template <typename... T>
+struct layout
+{
+    enum : size_t { size = sizeof...(T) };
+
+    template <size_t N>
+    using field_t = type_at<N, T...>;
+
+    static constexpr size_t offset(size_t n)
+    {
+        const size_t sizes [] = { sizeof (T)..., 0 };
+        const size_t aligns[] = { alignof(T)..., 1 };
+        size_t off = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            off += sizes[i];
+            off  = (off + aligns[i + 1] - 1) / aligns[i + 1] * aligns[i + 1];
+        }
+        return off;
+    }
+
+    template <size_t N, typename U>
+    static auto & get(U&& tar)
+    {
+        enum : size_t { off = offset(N) };
+        using tar_t  = typename std::remove_reference<U>::type;
+        using cast_t = typename std::conditional<std::is_const<tar_t>::value, const field_t<N>, field_t<N>>::type;
+        using byte_t = typename std::conditional<std::is_const<tar_t>::value, const char, char>::type;
+        return *reinterpret_cast<cast_t*>(reinterpret_cast<byte_t*>(std::addressof(tar)) + off);
+    }
+};
+
+/*
+ * The layout given by the pointers to the members, for the types which aren't standard-layout,
+ * or which should be matched in a constant expression (a reinterpret_cast can't be).
+*/
+
+template <typename T>
+struct member_type;
+template <typename C, typename F>
+struct member_type<F C::*> { using type = F; };
+
+template <typename T, T M>
+struct member
+{
+    using field_t = typename member_type<T>::type;
+
+    template <typename U>
+    static constexpr auto & get(U& tar)
+    {
+        return tar.*M;
+    }
+};
+
+template <typename... M>
+struct member_layout
+{
+    enum : size_t { size = sizeof...(M) };
+
+    template <size_t N>
+    using member_t = type_at<N, M...>;
+
+    template <size_t N>
+    using field_t = typename member_t<N>::field_t;
+
+    template <size_t N, typename U>
+    static constexpr auto & get(U&& tar)
+    {
+        return member_t<N>::get(tar);
+    }
+};
+
+template <class Bind>
+struct bindings_base
+{
+    // The fields are tested in order, and stop at the first mismatch. It's expanded flat
+    // rather than recursively, to keep the instantiations from growing with the fields.
+
+    template <typename T, typename U, size_t... I>
+    static constexpr bool apply(const T& tp, U& tar, std::index_sequence<I...>)
+    {
+        using layout_t = typename Bind::layout_t;
+        bool ok = true;
+        using expand = bool[];
+        (void)expand { (ok = ok && static_cast<bool>(get<I>(tp)(layout_t::template get<I>(tar))))..., true };
+        return ok;
+    }
+
+    template <typename T, typename U>
+    static constexpr auto apply(const T& tp, U&& tar)
+        -> typename std::enable_if<std::is_pointer<underlying<U>>::value, bool>::type
+    {
+        return (tar != nullptr) && apply(tp, *tar, std::make_index_sequence<std::tuple_size<T>::value>{});
+    }
+
+    template <typename T, typename U>
+    static constexpr auto apply(const T& tp, U&& tar)
+        -> typename std::enable_if<!std::is_pointer<underlying<U>>::value, bool>::type
+    {
+        return apply(tp, tar, std::make_index_sequence<std::tuple_size<T>::value>{});
+    }
+};
+
+/*
+ * The types which aren't registered are taken apart without a registration, if they could be:
+ * the tuple-like ones (std::pair, std::tuple, std::array...) by std::get, and (C++17) the aggregates
+ * by a structured binding. Each field is given by reference, so nothing is copied for a test.
+*/
+
+template <class C, typename = void>
+struct bindings;
+
+template <typename T, typename = void>
+struct is_tuple_like : std::false_type {};
+template <typename T>
+struct is_tuple_like<T, decltype(void(std::tuple_size<T>::value))> : std::true_type {};
+
+template <typename T>
+struct tuple_layout
+{
+    enum : size_t { size = std::tuple_size<T>::value };
+
+    template <size_t N>
+    using field_t = typename std::tuple_element<N, T>::type;
+
+    template <size_t N, typename U>
+    static constexpr auto & get(U&& tar)
+    {
+        return std::get<N>(tar);
+    }
+};
+
+// A pointer to one of them is taken apart as the object it points to (bindings_base::apply).
+
+template <class C>
+struct bindings<C, typename std::enable_if<is_tuple_like<std::remove_pointer_t<C>>::value>::type>
+    : bindings_base<bindings<C>>
+{
+    using layout_t = tuple_layout<std::remove_pointer_t<C>>;
+};
+
+#if __cplusplus >= 201703L
+
+/*
+ * The number of the fields of an aggregate is the most initializers it could be braced with.
+ * A field of an array type is counted as its elements (for the brace elision), so such an aggregate
+ * should be registered instead.
+*/
+
+struct any_field
+{
+    template <typename T>
+    operator T(void) const;
+};
+
+template <typename T, typename S, typename = void>
+struct is_braced_with : std::false_type {};
+template <typename T, size_t... I>
+struct is_braced_with<T, std::index_sequence<I...>, std::void_t<decltype(T{ (void(I), any_field{})... })>> : std::true_type {};
+
+template <typename T, size_t N = 16> // up to the fields of aggregate_tie
+struct aggregate_arity
+    : std::conditional_t<is_braced_with<T, std::make_index_sequence<N>>::value,
+                         std::integral_constant<size_t, N>, aggregate_arity<T, N - 1>> {};
+template <typename T>
+struct aggregate_arity<T, 0> : std::integral_constant<size_t, 0> {};
+
+template <size_t N>
+struct aggregate_tie;
+
+#define MATCH_AGGREGATE_TIE_(N, ...)                        \
+    template <> struct aggregate_tie<N>                     \
+    {                                                       \
+        template <typename U>                               \
+        static auto apply(U& tar)                           \
+        {                                                   \
+            auto& [__VA_ARGS__] = tar;                      \
+            return std::forward_as_tuple(__VA_ARGS__);      \
+        }                                                   \
+    };
+
+MATCH_AGGREGATE_TIE_(1 , a1)
+MATCH_AGGREGATE_TIE_(2 , a1, a2)
+MATCH_AGGREGATE_TIE_(3 , a1, a2, a3)
+MATCH_AGGREGATE_TIE_(4 , a1, a2, a3, a4)
+MATCH_AGGREGATE_TIE_(5 , a1, a2, a3, a4, a5)
+MATCH_AGGREGATE_TIE_(6 , a1, a2, a3, a4, a5, a6)
+MATCH_AGGREGATE_TIE_(7 , a1, a2, a3, a4, a5, a6, a7)
+MATCH_AGGREGATE_TIE_(8 , a1, a2, a3, a4, a5, a6, a7, a8)
+MATCH_AGGREGATE_TIE_(9 , a1, a2, a3, a4, a5, a6, a7, a8, a9)
+MATCH_AGGREGATE_TIE_(10, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10)
+MATCH_AGGREGATE_TIE_(11, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11)
+MATCH_AGGREGATE_TIE_(12, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12)
+MATCH_AGGREGATE_TIE_(13, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13)
+MATCH_AGGREGATE_TIE_(14, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14)
+MATCH_AGGREGATE_TIE_(15, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15)
+MATCH_AGGREGATE_TIE_(16, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, a16)
+
+#undef MATCH_AGGREGATE_TIE_
+
+template <typename T>
+struct aggregate_layout
+{
+    using tie_t = aggregate_tie<aggregate_arity<T>::value>;
+
+    enum : size_t { size = aggregate_arity<T>::value };
+
+    template <size_t N>
+    using field_t = std::remove_reference_t<std::tuple_element_t<N, decltype(tie_t::apply(std::declval<T&>()))>>;
+
+    template <size_t N, typename U>
+    static auto & get(U&& tar)
+    {
+        return std::get<N>(tie_t::apply(tar));
+    }
+};
+
+template <typename T>
+struct is_plain_aggregate
+    : std::integral_constant<bool, std::is_aggregate<T>::value && std::is_class<T>::value && !is_tuple_like<T>::value> {};
+
+template <class C>
+struct bindings<C, typename std::enable_if<is_plain_aggregate<std::remove_pointer_t<C>>::value>::type>
+    : bindings_base<bindings<C>>
+{
+    using layout_t = aggregate_layout<std::remove_pointer_t<C>>;
+};
+
+#endif // __cplusplus >= 201703L
+
+template <typename C, typename... T>
+struct constructor : pack<T...>
+{
+    using pack_t = pack<T...>;
+
+    template <typename... U, typename = typename std::enable_if<is_parts_of<constructor, U...>::value>::type>
+    constexpr constructor(U&&... args)
+        : pack_t(std::forward<U>(args)...)
+    {}
+
+    template <typename U>
+    constexpr auto operator()(U&& tar) const
+        -> typename std::enable_if<!is_smart_pointer<underlying<U>>::value, bool>::type
+    {
+        if ( type<C>{}(std::forward<U>(tar)) )
+        {
+            return bindings<underlying<U>>::apply(this->parts(), std::forward<U>(tar));
+        }
+        return false;
+    }
+
+    // Matches the object a smart pointer points to (a null one never matches).
+
+    template <typename U>
+    auto operator()(const U& tar) const
+        -> typename std::enable_if<is_smart_pointer<U>::value, bool>::type
+    {
+        return (tar.get() != nullptr) && (*this)(*tar);
+    }
+};
+
+template <typename C, typename... T>
+struct is_pattern<constructor<C, T...>> : std::true_type{};
+
+#define MATCH_REGIST_LAYOUT_(TYPE, ...)                                   \
+    namespace match                                                       \
+    {                                                                     \
+        template <> struct bindings<TYPE> : bindings_base<bindings<TYPE>> \
+        {                                                                 \
+            using layout_t = __VA_ARGS__;                                 \
+        };                                                                \
+        template <> struct bindings<TYPE*> : bindings<TYPE> {};           \
+    }
+
+#define MATCH_REGIST_TYPE(TYPE, ...) MATCH_REGIST_LAYOUT_(TYPE, match::layout<__VA_ARGS__>)
+
+// MATCH_REGIST_MEMBERS(point, x_, y_), the fields are taken by the pointers to the members.
+
+#define MATCH_MEMBER_(N, TYPE, ...)   match::member<decltype(&TYPE::CAPO_PP_A_(N, __VA_ARGS__)), &TYPE::CAPO_PP_A_(N, __VA_ARGS__)>
+#define MATCH_MEMBER_1_(N, TYPE, ...) MATCH_MEMBER_(N, TYPE, __VA_ARGS__)
+#define MATCH_MEMBER_N_(N, TYPE, ...) , MATCH_MEMBER_(N, TYPE, __VA_ARGS__)
+
+#define MATCH_REGIST_MEMBERS(TYPE, ...)                                                                           \
+    MATCH_REGIST_LAYOUT_(TYPE, match::member_layout<CAPO_PP_REPEATEX_(CAPO_PP_COUNT_(__VA_ARGS__),                \
+                                                                      MATCH_MEMBER_1_, MATCH_MEMBER_N_, TYPE, __VA_ARGS__)>)
+
+/*
+ * Sequence pattern
+*/
+
+template <typename... T>
+struct sequence : pack<T...>
+{
+    using pack_t = pack<T...>;
+
+    template <typename... U, typename = typename std::enable_if<is_parts_of<sequence, U...>::value>::type>
+    constexpr sequence(U&&... args)
+        : pack_t(std::forward<U>(args)...)
+    {}
+
+    template <size_t N, typename U, typename It>
+    auto apply(U&&, It&&) const
+        -> typename std::enable_if<(sizeof...(T) <= N), bool>::type
+    {
+        return true;
+    }
+
+    template <size_t N, typename U, typename It>
+    auto apply(U&& tar, It&& it) const
+        -> typename std::enable_if<(sizeof...(T) > N), bool>::type
+    {
+        if ( it == tar.end() )       return false;
+        if ( get<N>(this->parts())(*it) ) return apply<N + 1>(std::forward<U>(tar), ++it);
+        return false;
+    }
+
+    // A tuple-like target (e.g. a std::array) is taken apart by std::get, which is constexpr.
+
+    template <size_t N, typename U>
+    constexpr auto apply(const U&) const
+        -> typename std::enable_if<(sizeof...(T) <= N), bool>::type
+    {
+        return true;
+    }
+
+    template <size_t N, typename U>
+    constexpr auto apply(const U&) const
+        -> typename std::enable_if<(sizeof...(T) > N) && (std::tuple_size<U>::value <= N), bool>::type
+    {
+        return false;
+    }
+
+    template <size_t N, typename U>
+    constexpr auto apply(const U& tar) const
+        -> typename std::enable_if<(sizeof...(T) > N) && (std::tuple_size<U>::value > N), bool>::type
+    {
+        if ( get<N>(this->parts())(std::get<N>(tar)) ) return apply<N + 1>(tar);
+        return false;
+    }
+
+    template <typename U>
+    auto operator()(U&& tar) const
+        -> typename std::enable_if<!is_tuple_like<underlying<U>>::value, bool>::type
+    {
+        return apply<0>(std::forward<U>(tar), tar.begin());
+    }
+
+    template <typename U>
+    constexpr auto operator()(U&& tar) const
+        -> typename std::enable_if<is_tuple_like<underlying<U>>::value, bool>::type
+    {
+        return apply<0>(tar);
+    }
+};
+
+template <typename... T>
+struct is_pattern<sequence<T...>> : std::true_type{};
+
+/*
+ * Option patterns, for the pointers, smart pointers and optionals:
+ * Some(p) matches an engaged (non-null) one whose value matches p, and None matches an empty one.
+ * The value is tested by reference, without copying anything.
+*/
+
+template <typename P>
+struct some
+{
+    P p_;
+
+    template <typename U>
+    constexpr bool operator()(U&& tar) const
+    {
+        return static_cast<bool>(tar) && p_(*tar);
+    }
+};
+
+template <typename P>
+struct is_pattern<some<P>> : std::true_type {};
+
+struct none_t
+{
+    constexpr none_t(void) {}
+
+    template <typename U>
+    constexpr bool operator()(const U& tar) const
+    {
+        return !tar;
+    }
+};
+
+constexpr none_t None;
+
+template <>
+struct is_pattern<none_t> : std::true_type {};
+
+/*
+ * Binary pattern, for destructuring packed fields straight out of a byte buffer,
+ * just like the bit syntax of Erlang.
+*/
+
+struct bytes
+{
+    const std::uint8_t* data_ = nullptr;
+    size_t              size_ = 0;
+
+    bytes(void) = default;
+
+    bytes(const void* p, size_t n)
+        : data_(static_cast<const std::uint8_t*>(p)), size_(n)
+    {}
+
+    template <typename T, typename = decltype(std::declval<const T&>().data()),
+                          typename = decltype(std::declval<const T&>().size()),
+              typename = typename std::enable_if<!std::is_same<T, bytes>::value &&
+                                                 (sizeof(*std::declval<const T&>().data()) == 1)>::type>
+    bytes(const T& buf)
+        : bytes(buf.data(), buf.size())
+    {}
+
+    const std::uint8_t* data (void) const { return data_; }
+    size_t              size (void) const { return size_; }
+    bool                empty(void) const { return size_ == 0; }
+    const std::uint8_t* begin(void) const { return data_; }
+    const std::uint8_t* end  (void) const { return data_ + size_; }
+
+    std::uint8_t operator[](size_t i) const { return data_[i]; }
+
+    friend bool operator==(const bytes& x, const bytes& y)
+    {
+        return (x.size_ == y.size_) && ((x.size_ == 0) || (std::memcmp(x.data_, y.data_, x.size_) == 0));
+    }
+    friend bool operator!=(const bytes& x, const bytes& y) { return !(x == y); }
+};
+
+template <size_t Bits>
+using bin_uint = typename std::conditional<(Bits <= 8 ), std::uint8_t ,
+                 typename std::conditional<(Bits <= 16), std::uint16_t,
+                 typename std::conditional<(Bits <= 32), std::uint32_t,
+                                                         std::uint64_t>::type>::type>::type;
+
+inline std::uint64_t bin_bswap(std::uint64_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_bswap64(v);
+#else
+    v = ((v & 0x00ff00ff00ff00ffull) << 8 ) | ((v >> 8 ) & 0x00ff00ff00ff00ffull);
+    v = ((v & 0x0000ffff0000ffffull) << 16) | ((v >> 16) & 0x0000ffff0000ffffull);
+    return (v << 32) | (v >> 32);
+#endif
+}
+
+// Loads 8 bytes from p as a big-endian word, zero-filling anything beyond n bytes.
+
+inline std::uint64_t bin_load_word(const std::uint8_t* p, size_t n)
+{
+    std::uint64_t v = 0;
+    if (n >= 8)
+    {
+        std::memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        return v;
+#else
+        return bin_bswap(v);
+#endif
+    }
+    for (size_t i = 0; i < n; ++i) v |= std::uint64_t(p[i]) << (56 - 8 * i);
+    return v;
+}
+
+// Reads "width" bits (1 ~ 64) from the bit offset "pos", most significant bit first.
+
+inline std::uint64_t bin_read_be(const bytes& buf, size_t pos, size_t width)
+{
+    size_t first = pos / 8, shift = pos % 8;
+    std::uint64_t v = bin_load_word(buf.data() + first, buf.size() - first) << shift;
+    if (shift + width > 64) v |= std::uint64_t(buf[first + 8] >> (8 - shift));
+    return v >> (64 - width);
+}
+
+// Reads "width" bits (8, 16, ..., 64) from the byte aligned bit offset "pos", least significant byte first.
+
+inline std::uint64_t bin_read_le(const bytes& buf, size_t pos, size_t width)
+{
+    const std::uint8_t* p = buf.data() + pos / 8;
+    std::uint64_t v = 0;
+    for (size_t i = 0; i < width / 8; ++i) v |= std::uint64_t(p[i]) << (8 * i);
+    return v;
+}
+
+/*
+ * The binary fields:
+ *  - bin_int<Bits, Little, P>: an unsigned integer of a fixed width
+ *  - bin_take<Bytes, P>      : a fixed size slice
+ *  - bin_slice<Prefix, P>    : a slice with a big-endian length prefix (Prefix bytes),
+ *                              or all the remaining bytes when Prefix is 0
+ * The slices are bound as zero-copy "bytes" views.
+*/
+
+template <size_t Bits, bool Little, typename P>
+struct bin_int
+{
+    static_assert((Bits > 0) && (Bits <= 64), "The width of a binary integer must be in [1, 64].");
+    static_assert(!Little || (Bits % 8 == 0), "A little-endian binary integer must be made of whole bytes.");
+
+    enum : size_t { width = Bits, dynamic = false };
+    P p_;
+
+    bool apply(const bytes& buf, size_t& pos) const
+    {
+        if (buf.size() * 8 - pos < Bits) return false;
+        if (Little && (pos % 8 != 0)) return false;
+        auto v = static_cast<bin_uint<Bits>>(Little ? bin_read_le(buf, pos, Bits) : bin_read_be(buf, pos, Bits));
+        pos += Bits;
+        return p_(v);
+    }
+};
+
+template <size_t Bytes, typename P>
+struct bin_take
+{
+    enum : size_t { width = Bytes * 8, dynamic = false };
+    P p_;
+
+    bool apply(const bytes& buf, size_t& pos) const
+    {
+        if ((pos % 8 != 0) || (buf.size() - pos / 8 < Bytes)) return false;
+        bytes v { buf.data() + pos / 8, Bytes };
+        pos += width;
+        return p_(v);
+    }
+};
+
+template <size_t Prefix, typename P>
+struct bin_slice
+{
+    static_assert(Prefix <= 8, "The length prefix of a binary slice must be in [0, 8] bytes.");
+
+    enum : size_t { width = 0, dynamic = true };
+    P p_;
+
+    bool apply(const bytes& buf, size_t& pos) const
+    {
+        if (pos % 8 != 0) return false;
+        size_t n = buf.size() - pos / 8;
+        if (Prefix > 0)
+        {
+            if (n < Prefix) return false;
+            std::uint64_t len = bin_read_be(buf, pos, Prefix * 8);
+            pos += Prefix * 8;
+            n -= Prefix;
+            if (len > n) return false;
+            n = static_cast<size_t>(len);
+        }
+        bytes v { buf.data() + pos / 8, n };
+        pos += n * 8;
+        return p_(v);
+    }
+};
+
+/*
+ * The constant integer fields laid at fixed offsets in front of the first slice are
+ * folded into (mask, value) pairs of big-endian 64-bit words when the pattern is built,
+ * so that they could be checked with a few wide loads instead of field by field.
+*/
+
+template <typename F>
+struct bin_foldable : std::false_type {};
+template <size_t Bits, bool Little, typename T>
+struct bin_foldable<bin_int<Bits, Little, constant<T>>>
+    : std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value> {};
+template <size_t Bits, bool Little, typename T>
+struct bin_foldable<bin_int<Bits, Little, value<T>>>
+    : std::integral_constant<bool, std::is_integral<T>::value || std::is_enum<T>::value> {};
+
+template <typename T> inline bool bin_negative(T v, std::true_type)  { return v < 0; }
+template <typename T> inline bool bin_negative(T  , std::false_type) { return false; }
+
+template <typename... F>
+constexpr size_t bin_fixed_count(void)
+{
+    const bool dyn[] = { bool(F::dynamic)..., true };
+    size_t n = 0;
+    while (!dyn[n]) ++n;
+    return n;
+}
+
+template <typename... F>
+constexpr size_t bin_fixed_bits(void)
+{
+    const size_t wid[] = { size_t(F::width)..., 0 };
+    size_t s = 0;
+    for (size_t i = 0; i < bin_fixed_count<F...>(); ++i) s += wid[i];
+    return s;
+}
+
+template <typename... F>
+struct binary
+{
+    enum : size_t
+    {
+        fixed_count = bin_fixed_count<F...>(),
+        fixed_bits  = bin_fixed_bits<F...>(),
+        words       = (fixed_bits + 63) / 64,
+        slots       = words + (fixed_bits == 0)
+    };
+
+    std::tuple<F...> fs_;
+    std::uint64_t    mask_[slots] = {};
+    std::uint64_t    code_[slots] = {};
+    bool             never_ = false;
+
+    template <typename... U, typename = typename std::enable_if<!is_self<binary, U...>::value>::type>
+    binary(U&&... args)
+        : fs_(std::forward<U>(args)...)
+    {
+        fold<0>(0);
+    }
+
+    void put(size_t pos, size_t width, std::uint64_t v)
+    {
+        while (width > 0)
+        {
+            size_t k = pos / 64, off = pos % 64;
+            size_t n = (width < 64 - off) ? width : 64 - off;
+            std::uint64_t m = (n == 64) ? ~std::uint64_t(0) : ((std::uint64_t(1) << n) - 1);
+            mask_[k] |= m << (64 - off - n);
+            code_[k] |= ((v >> (width - n)) & m) << (64 - off - n);
+            pos   += n;
+            width -= n;
+        }
+    }
+
+    template <size_t Bits, bool Little, typename T>
+    void fold_field(const bin_int<Bits, Little, constant<T>>& f, size_t pos)
+    {
+        fold_value<Bits, Little, T>(f.p_.t_, pos);
+    }
+
+    template <size_t Bits, bool Little, typename T>
+    void fold_field(const bin_int<Bits, Little, value<T>>& f, size_t pos)
+    {
+        fold_value<Bits, Little, T>(f.p_.t_, pos);
+    }
+
+    template <size_t Bits, bool Little, typename T>
+    void fold_value(const T& t, size_t pos)
+    {
+        using v_t = typename std::conditional<std::is_enum<T>::value, 
+                                              std::underlying_type<T>, std::common_type<T>>::type::type;
+        auto v = static_cast<v_t>(t);
+        if (bin_negative(v, std::is_signed<v_t>{}) || ((Bits < 64) && (static_cast<std::uint64_t>(v) >> (Bits % 64)) != 0))
+        {
+            never_ = true; // this constant could never fit in its field
+            return;
+        }
+        if (Little && (pos % 8 != 0))
+        {
+            never_ = true; // bin_int::apply rejects a little-endian field which isn't byte aligned
+            return;
+        }
+        if (Little)
+             for (size_t i = 0; i < Bits / 8; ++i) put(pos + i * 8, 8, static_cast<std::uint64_t>(v) >> (i * 8));
+        else put(pos, Bits, static_cast<std::uint64_t>(v));
+    }
+
+    template <typename T>
+    void fold_field(const T&, size_t) {}
+
+    template <size_t N>
+    auto fold(size_t) -> typename std::enable_if<(N >= fixed_count)>::type {}
+
+    template <size_t N>
+    auto fold(size_t pos) -> typename std::enable_if<(N < fixed_count)>::type
+    {
+        fold_field(std::get<N>(fs_), pos);
+        fold<N + 1>(pos + type_at<N, F...>::width);
+    }
+
+    bool check_words(const bytes& buf) const
+    {
+        for (size_t k = 0; k < words; ++k)
+        {
+            if (mask_[k] == 0) continue;
+            if ((bin_load_word(buf.data() + k * 8, buf.size() - k * 8) & mask_[k]) != code_[k]) return false;
+        }
+        return true;
+    }
+
+    template <size_t N>
+    auto apply(const bytes&, size_t&) const
+        -> typename std::enable_if<(sizeof...(F) <= N), bool>::type
+    {
+        return true;
+    }
+
+    template <size_t N>
+    auto apply(const bytes& buf, size_t& pos) const
+        -> typename std::enable_if<(sizeof...(F) > N), bool>::type
+    {
+        using f_t = type_at<N, F...>;
+        if ((N < fixed_count) && bin_foldable<f_t>::value)
+        {
+            pos += f_t::width; // has been checked by check_words
+        }
+        else if (!std::get<N>(fs_).apply(buf, pos)) return false;
+        return apply<N + 1>(buf, pos);
+    }
+
+    bool operator()(const bytes& buf) const
+    {
+        if (never_ || (buf.size() * 8 < fixed_bits) || !check_words(buf)) return false;
+        size_t pos = 0;
+        return apply<0>(buf, pos) && (pos == buf.size() * 8);
+    }
+
+    template <typename U>
+    auto operator()(const U& tar) const
+        -> typename std::enable_if<std::is_convertible<const U&, bytes>::value && 
+                                  !std::is_same<U, bytes>::value, bool>::type
+    {
+        return (*this)(bytes(tar));
+    }
+};
+
+template <typename... F>
+struct is_pattern<binary<F...>> : std::true_type{};
+
+/*
+ * "filter" is a common function used to provide convenience to the users by converting 
+ * constant values into constant patterns and regular variables into variable patterns.
+ * If the users defined a suitable converter for a specific type, the filter would choose
+ * the custom converter for wrapping that variable of the type.
+*/
+
+void converter(...);
+
+// A named pattern is referred to, while a temporary or a stateless one is held by value,
+// so that a nested pattern owns its parts (and could be made in a constant expression),
+// and the stateless ones take no storage.
+
+template <typename T>
+constexpr auto filter(T&& arg)
+    -> typename std::enable_if<pattern_checker<T>::value && std::is_lvalue_reference<T>::value &&
+                              !std::is_empty<underlying<T>>::value, T&&>::type
+{
+    return std::forward<T>(arg);
+}
+
+template <typename T>
+constexpr auto filter(T&& arg)
+    -> typename std::enable_if<pattern_checker<T>::value && (!std::is_lvalue_reference<T>::value ||
+                               std::is_empty<underlying<T>>::value), underlying<T>>::type
+{
+    return std::forward<T>(arg);
+}
+
+template <typename T>
+constexpr auto filter(const T& arg)
+    -> typename std::enable_if<!pattern_checker<T>::value && 
+                                std::is_same<decltype(converter(arg)), void>::value, 
+                                constant<T>>::type
+{
+    return { arg };
+}
+
+// A nullptr is a literal, so it could be a part of a constant expression too.
+
+constexpr literal<std::nullptr_t, nullptr> filter(std::nullptr_t)
+{
+    return {};
+}
+
+template <typename T>
+constexpr auto filter(T& arg)
+    -> typename std::enable_if<!pattern_checker<T>::value && 
+                                std::is_same<decltype(converter(arg)), void>::value, 
+                                variable<T>>::type
+{
+    return { arg };
+}
+
+template <typename T>
+inline auto filter(T&& arg)
+    -> typename std::enable_if<!pattern_checker<T>::value && 
+                               !std::is_same<decltype(converter(std::forward<T>(arg))), void>::value, 
+                                             decltype(converter(std::forward<T>(arg)))>::type
 {
     return converter(std::forward<T>(arg));
 }
 
 /*
- * Here is a part of the constructor & sequence pattern.
- * I have to implement it here, because gcc needs the filter be declared before it.
+ * Here is a part of the constructor & sequence pattern.
+ * I have to implement it here, because gcc needs the filter be declared before it.
+*/
+
+template <typename T = wildcard, typename... P>
+constexpr auto C(P&&... args)
+    -> constructor<T, decltype(filter(std::forward<P>(args)))...>
+{
+    return { filter(std::forward<P>(args))... };
+}
+
+template <typename... P>
+constexpr auto S(P&&... args)
+    -> sequence<decltype(filter(std::forward<P>(args)))...>
+{
+    return { filter(std::forward<P>(args))... };
+}
+
+template <typename P>
+constexpr auto Some(P&& arg)
+    -> some<decltype(filter(std::forward<P>(arg)))>
+{
+    return { filter(std::forward<P>(arg)) };
+}
+
+// The binary fields & pattern: Bin(be<4>(ver), be<4>(_), be<16>(0x1234), le<32>(id), slice<2>(payload))
+
+template <size_t Bits, typename P>
+inline auto be(P&& arg)
+    -> bin_int<Bits, false, decltype(filter(std::forward<P>(arg)))>
+{
+    return { filter(std::forward<P>(arg)) };
+}
+
+template <size_t Bits>
+inline bin_int<Bits, false, wildcard> be(void) { return {}; }
+
+template <size_t Bits, typename P>
+inline auto le(P&& arg)
+    -> bin_int<Bits, true, decltype(filter(std::forward<P>(arg)))>
+{
+    return { filter(std::forward<P>(arg)) };
+}
+
+template <size_t Bits>
+inline bin_int<Bits, true, wildcard> le(void) { return {}; }
+
+template <size_t Bytes, typename P>
+inline auto take(P&& arg)
+    -> bin_take<Bytes, decltype(filter(std::forward<P>(arg)))>
+{
+    return { filter(std::forward<P>(arg)) };
+}
+
+template <size_t Bytes>
+inline bin_take<Bytes, wildcard> take(void) { return {}; }
+
+template <size_t Prefix, typename P>
+inline auto slice(P&& arg)
+    -> bin_slice<Prefix, decltype(filter(std::forward<P>(arg)))>
+{
+    return { filter(std::forward<P>(arg)) };
+}
+
+template <typename P>
+inline auto rest(P&& arg)
+    -> bin_slice<0, decltype(filter(std::forward<P>(arg)))>
+{
+    return { filter(std::forward<P>(arg)) };
+}
+
+inline bin_slice<0, wildcard> rest(void) { return {}; }
+
+template <typename... F>
+inline auto Bin(F&&... fields)
+    -> binary<underlying<F>...>
+{
+    return { std::forward<F>(fields)... };
+}
+
+/*
+ * Holds the targets of a match: the lvalues by reference, and the temporaries by value,
+ * because a temporary would die at the end of the declaration of "target_".
+*/
+
+template <typename... T>
+constexpr std::tuple<T...> capture(T&&... args)
+{
+    return std::tuple<T...>(std::forward<T>(args)...);
+}
+
+/*
+ * "keep" works like "filter", but gives a pattern owning all of its parts, which could be
+ * stored and used after its arguments have gone. The values (even the lvalues) become value
+ * patterns, the string literals are kept as std::string, and the nested constructor & sequence
+ * patterns are kept recursively. A kept pattern can't bind variables.
+*/
+
+template <typename T>
+struct kept_value { using type = typename std::decay<T>::type; };
+template <typename T, size_t N>
+struct kept_value<T[N]> { using type = typename std::conditional<std::is_same<underlying<T>, char>::value, 
+                                                                 std::string, const T*>::type; };
+
+template <typename P>
+inline underlying<P> keep_pattern(const P& p)
+{
+    return p;
+}
+
+template <typename T>
+inline value<typename kept_value<T>::type> keep_pattern(const constant<T>& p)
+{
+    return { p.t_ };
+}
+
+template <typename T>
+inline void keep_pattern(const variable<T>&)
+{
+    static_assert(!std::is_same<T, T>::value, "A kept pattern can't bind variables.");
+}
+
+template <typename F>
+inline predicate<underlying<F>> keep_pattern(const predicate<F>& p)
+{
+    return { p.judge_ };
+}
+
+template <typename R, typename T, size_t... I>
+inline R keep_patterns(const T& tp, std::index_sequence<I...>)
+{
+    return { keep_pattern(get<I>(tp))... };
+}
+
+template <typename C, typename... T>
+inline auto keep_pattern(const constructor<C, T...>& p)
+    -> constructor<C, decltype(keep_pattern(std::declval<const underlying<T>&>()))...>
+{
+    using r_t = constructor<C, decltype(keep_pattern(std::declval<const underlying<T>&>()))...>;
+    return keep_patterns<r_t>(p.parts(), std::index_sequence_for<T...>{});
+}
+
+template <typename... T>
+inline auto keep_pattern(const sequence<T...>& p)
+    -> sequence<decltype(keep_pattern(std::declval<const underlying<T>&>()))...>
+{
+    using r_t = sequence<decltype(keep_pattern(std::declval<const underlying<T>&>()))...>;
+    return keep_patterns<r_t>(p.parts(), std::index_sequence_for<T...>{});
+}
+
+template <typename P>
+inline auto keep_pattern(const some<P>& p)
+    -> some<decltype(keep_pattern(p.p_))>
+{
+    return { keep_pattern(p.p_) };
+}
+
+template <size_t Bits, bool Little, typename P>
+inline auto keep_pattern(const bin_int<Bits, Little, P>& f)
+    -> bin_int<Bits, Little, decltype(keep_pattern(f.p_))>
+{
+    return { keep_pattern(f.p_) };
+}
+
+template <size_t Bytes, typename P>
+inline auto keep_pattern(const bin_take<Bytes, P>& f)
+    -> bin_take<Bytes, decltype(keep_pattern(f.p_))>
+{
+    return { keep_pattern(f.p_) };
+}
+
+template <size_t Prefix, typename P>
+inline auto keep_pattern(const bin_slice<Prefix, P>& f)
+    -> bin_slice<Prefix, decltype(keep_pattern(f.p_))>
+{
+    return { keep_pattern(f.p_) };
+}
+
+template <typename... F>
+inline auto keep_pattern(const binary<F...>& p)
+    -> binary<decltype(keep_pattern(std::declval<const F&>()))...>
+{
+    using r_t = binary<decltype(keep_pattern(std::declval<const F&>()))...>;
+    return keep_patterns<r_t>(p.fs_, std::index_sequence_for<F...>{});
+}
+
+template <typename T>
+inline auto keep(T&& arg)
+    -> typename std::enable_if<pattern_checker<T>::value, decltype(keep_pattern(arg))>::type
+{
+    return keep_pattern(arg);
+}
+
+template <typename T>
+inline auto keep(T&& arg)
+    -> typename std::enable_if<!pattern_checker<T>::value && 
+                                std::is_same<decltype(converter(std::forward<T>(arg))), void>::value, 
+                                value<typename kept_value<underlying<T>>::type>>::type
+{
+    return { std::forward<T>(arg) };
+}
+
+template <typename T>
+inline auto keep(T&& arg)
+    -> typename std::enable_if<!pattern_checker<T>::value && 
+                               !std::is_same<decltype(converter(std::forward<T>(arg))), void>::value, 
+                                decltype(keep_pattern(converter(std::forward<T>(arg))))>::type
+{
+    return keep_pattern(converter(std::forward<T>(arg)));
+}
+
+/*
+ * The match site keeps the results of the expensive sub-patterns within one match attempt,
+ * so the same sub-pattern on the same column is evaluated only once:
+ *  - across the disjuncts & conjuncts of a With(...), for the structurally equal patterns;
+ *  - across the arms, for the named (lvalue) pattern objects and the stateless ones.
+ * Only the pure patterns (without any variable binding) are cached, and only when they are
+ * expensive enough (see "is_memoized") to be worth a lookup.
+*/
+
+template <bool...>
+struct bool_pack_ {};
+
+// True if all of the T::value are, compared as a whole pack rather than one by one.
+
+template <typename... T>
+struct all_of : std::is_same<bool_pack_<true, T::value...>, bool_pack_<T::value..., true>> {};
+
+template <typename T>
+struct is_pure : std::true_type {};
+template <typename T>
+struct is_pure<variable<T>> : std::false_type {};
+template <typename C, typename... T>
+struct is_pure<constructor<C, T...>> : all_of<is_pure<underlying<T>>...> {};
+template <typename... T>
+struct is_pure<sequence<T...>> : all_of<is_pure<underlying<T>>...> {};
+template <typename... F>
+struct is_pure<binary<F...>> : all_of<is_pure<F>...> {};
+template <typename P>
+struct is_pure<some<P>> : is_pure<underlying<P>> {};
+template <size_t Bits, bool Little, typename P>
+struct is_pure<bin_int<Bits, Little, P>> : is_pure<underlying<P>> {};
+template <size_t Bytes, typename P>
+struct is_pure<bin_take<Bytes, P>> : is_pure<underlying<P>> {};
+template <size_t Prefix, typename P>
+struct is_pure<bin_slice<Prefix, P>> : is_pure<underlying<P>> {};
+
+template <typename T>
+struct is_memoized : std::false_type {};
+template <typename T>
+struct is_memoized<type<T, true>> : std::true_type {};
+template <typename C, typename... T>
+struct is_memoized<constructor<C, T...>> : is_pure<constructor<C, T...>> {};
+template <typename... T>
+struct is_memoized<sequence<T...>> : is_pure<sequence<T...>> {};
+template <typename... F>
+struct is_memoized<binary<F...>> : is_pure<binary<F...>> {};
+
+/*
+ * Whether a pattern never allocates: neither when it's made at its Case (a copy of a value,
+ * e.g. a std::string, or a std::regex being compiled), nor when it's tested (a variable binding
+ * assigns the target, e.g. to a std::string). The patterns not known here are judged by whether
+ * they are trivially copyable, so a user-defined pattern owning a std::string is rejected.
+ * It's conservative: a constant std::string is rejected even if it's an existing object.
+*/
+
+template <typename T>
+struct is_alloc_free : std::is_trivially_copyable<T> {};
+template <typename T>
+struct is_alloc_free<constant<T>> : std::integral_constant<bool, std::is_trivially_copyable<T>::value ||
+                                                                 std::is_array<T>::value> {};
+template <typename T>
+struct is_alloc_free<variable<T>> : std::is_trivially_copyable<T> {};
+template <typename F>
+struct is_alloc_free<predicate<F>> : std::is_trivially_copyable<underlying<F>> {};
+template <typename C, typename... T>
+struct is_alloc_free<constructor<C, T...>> : all_of<is_alloc_free<underlying<T>>...> {};
+template <typename... T>
+struct is_alloc_free<sequence<T...>> : all_of<is_alloc_free<underlying<T>>...> {};
+template <typename... F>
+struct is_alloc_free<binary<F...>> : all_of<is_alloc_free<F>...> {};
+template <typename P>
+struct is_alloc_free<some<P>> : is_alloc_free<underlying<P>> {};
+template <size_t Bits, bool Little, typename P>
+struct is_alloc_free<bin_int<Bits, Little, P>> : is_alloc_free<underlying<P>> {};
+template <size_t Bytes, typename P>
+struct is_alloc_free<bin_take<Bytes, P>> : is_alloc_free<underlying<P>> {};
+template <size_t Prefix, typename P>
+struct is_alloc_free<bin_slice<Prefix, P>> : is_alloc_free<underlying<P>> {};
+
+/*
+ * The compile-time cost estimate of the patterns, from the cheapest to the most expensive.
+ * When MATCH_COST_ORDER is 1, the side-effect-free columns of a row are evaluated cheapest first,
+ * and the binding columns are evaluated after them, in their written order.
+ * Note that a predicate is counted as side-effect-free, so it shouldn't read a variable bound
+ * by the same row in this mode.
+*/
+
+enum : size_t
+{
+    cost_wildcard,
+    cost_constant,
+    cost_type,
+    cost_constructor,
+    cost_predicate,
+    cost_regex,
+    cost_binding = size_t(-1)
+};
+
+template <typename T> struct pattern_cost                          : std::integral_constant<size_t, cost_predicate>   {};
+template <>           struct pattern_cost<wildcard>                : std::integral_constant<size_t, cost_wildcard>    {};
+template <typename T> struct pattern_cost<constant<T>>             : std::integral_constant<size_t, cost_constant>    {};
+template <typename T> struct pattern_cost<value<T>>                : std::integral_constant<size_t, cost_constant>    {};
+template <typename T, T V>
+                      struct pattern_cost<literal<T, V>>           : std::integral_constant<size_t, cost_constant>    {};
+template <typename T> struct pattern_cost<range<T>>                : std::integral_constant<size_t, cost_constant>    {};
+template <typename T, size_t N>
+                      struct pattern_cost<in_set<T, N>>            : std::integral_constant<size_t, cost_constant>    {};
+template <>           struct pattern_cost<bits>                    : std::integral_constant<size_t, cost_constant>    {};
+template <>           struct pattern_cost<none_t>                  : std::integral_constant<size_t, cost_constant>    {};
+template <typename T, bool Cond>
+                      struct pattern_cost<type<T, Cond>>           : std::integral_constant<size_t, cost_type>        {};
+template <typename C, typename... T>
+                      struct pattern_cost<constructor<C, T...>>    : std::integral_constant<size_t, cost_constructor> {};
+template <typename... T>
+                      struct pattern_cost<sequence<T...>>          : std::integral_constant<size_t, cost_constructor> {};
+template <typename P> struct pattern_cost<some<P>>                 : std::integral_constant<size_t, cost_constructor> {};
+template <typename... F>
+                      struct pattern_cost<binary<F...>>            : std::integral_constant<size_t, cost_constructor> {};
+
+template <typename T>
+struct column_cost : std::integral_constant<size_t, is_pure<T>::value ? pattern_cost<T>::value : size_t(cost_binding)> {};
+
+// Gets the column to be evaluated at the Nth position of a row.
+
+template <typename... P>
+constexpr size_t cost_column(size_t n)
+{
+    const size_t key[] = { column_cost<underlying<P>>::value..., 0 };
+    for (size_t i = 0; i < sizeof...(P); ++i)
+    {
+        size_t rank = 0;
+        for (size_t j = 0; j < sizeof...(P); ++j)
+        {
+            rank += (key[j] < key[i]) || ((key[j] == key[i]) && (j < i));
+        }
+        if (rank == n) return i;
+    }
+    return n;
+}
+
+template <typename... P>
+constexpr size_t row_column(size_t n)
+{
+    return MATCH_COST_ORDER ? cost_column<P...>(n) : n;
+}
+
+// Tells whether two patterns of the same type would always give the same result.
+
+template <typename T>
+struct is_plain_value 
+    : std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value || 
+                                   std::is_pointer<T>::value || std::is_member_pointer<T>::value> {};
+
+template <typename T>
+inline bool same_pattern(const T& x, const T& y)
+{
+    return std::is_empty<T>::value || (std::addressof(x) == std::addressof(y));
+}
+
+template <typename T>
+inline auto same_pattern(const constant<T>& x, const constant<T>& y)
+    -> typename std::enable_if<is_plain_value<T>::value, bool>::type
+{
+    return x.t_ == y.t_;
+}
+
+template <typename T>
+inline auto same_pattern(const value<T>& x, const value<T>& y)
+    -> typename std::enable_if<is_plain_value<T>::value, bool>::type
+{
+    return x.t_ == y.t_;
+}
+
+template <typename T, size_t N>
+inline auto same_pattern(const constant<T[N]>& x, const constant<T[N]>& y)
+    -> typename std::enable_if<std::is_arithmetic<T>::value, bool>::type
+{
+    return std::memcmp(x.t_, y.t_, sizeof(T) * N) == 0;
+}
+
+template <typename T>
+inline bool same_pattern(const range<T>& x, const range<T>& y)
+{
+    return !(x.lo_ != y.lo_) && !(x.hi_ != y.hi_);
+}
+
+template <typename T, size_t N>
+inline bool same_pattern(const in_set<T, N>& x, const in_set<T, N>& y)
+{
+    for (size_t i = 0; i < N; ++i) if (x.vs_[i] != y.vs_[i]) return false;
+    return true;
+}
+
+inline bool same_pattern(const bits& x, const bits& y)
+{
+    return (x.value_ == y.value_) && (x.mask_ == y.mask_);
+}
+
+template <typename T, size_t... I>
+inline bool same_patterns(const T& x, const T& y, std::index_sequence<I...>)
+{
+    bool same = true;
+    using expand = bool[];
+    (void)expand { (same = same && same_pattern(get<I>(x), get<I>(y)))..., true };
+    return same;
+}
+
+template <typename C, typename... T>
+inline bool same_pattern(const constructor<C, T...>& x, const constructor<C, T...>& y)
+{
+    return (std::addressof(x) == std::addressof(y)) || same_patterns(x.parts(), y.parts(), std::index_sequence_for<T...>{});
+}
+
+template <typename... T>
+inline bool same_pattern(const sequence<T...>& x, const sequence<T...>& y)
+{
+    return (std::addressof(x) == std::addressof(y)) || same_patterns(x.parts(), y.parts(), std::index_sequence_for<T...>{});
+}
+
+template <typename T>
+struct pattern_tag { static const char id_; };
+template <typename T>
+const char pattern_tag<T>::id_ = 0;
+
+template <typename T>
+inline bool same_pattern_erased(const void* x, const void* y)
+{
+    return same_pattern(*static_cast<const T*>(x), *static_cast<const T*>(y));
+}
+
+struct site_entry
+{
+    size_t      column_;
+    const void* tag_;
+    const void* pattern_;
+    bool      (*same_)(const void*, const void*);
+    unsigned    arm_;     // the arm holding a temporary pattern, or 0 for the whole site
+};
+
+template <size_t N = 8>
+class site
+{
+    static_assert(N <= 64, "A site could memoize up to 64 patterns.");
+
+    site_entry    entries_[N];
+    std::uint64_t results_ = 0; // the result of each entry, by its bit
+    size_t        size_    = 0;
+    unsigned   arm_  = 0;
+
+public:
+    bool begin_arm(void)
+    {
+        ++arm_;
+        return true;
+    }
+
+    // Tests the condition of an arm, which is a bool or a (lazy) row expression.
+
+    template <typename E>
+    bool test(const E& cond)
+    {
+        return static_cast<bool>(cond);
+    }
+
+    template <size_t Col, bool Named, typename P, typename U>
+    auto apply(const P& pat, U&& tar)
+        -> typename std::enable_if<!is_memoized<P>::value, bool>::type
+    {
+        return pat(std::forward<U>(tar));
+    }
+
+    template <size_t Col, bool Named, typename P, typename U>
+    auto apply(const P& pat, U&& tar)
+        -> typename std::enable_if<is_memoized<P>::value, bool>::type
+    {
+        const void* tag = &pattern_tag<P>::id_;
+        for (size_t i = 0; i < size_; ++i)
+        {
+            const site_entry& e = entries_[i];
+            if ((e.column_ == Col) && (e.tag_ == tag) && ((e.arm_ == 0) || (e.arm_ == arm_)) && 
+                (std::is_empty<P>::value || e.same_(e.pattern_, std::addressof(pat))))
+            {
+                return ((results_ >> i) & 1) != 0;
+            }
+        }
+        bool r = pat(std::forward<U>(tar));
+        if (size_ < N)
+        {
+            results_ |= static_cast<std::uint64_t>(r) << size_;
+            entries_[size_++] = { Col, tag, std::addressof(pat), &same_pattern_erased<P>,
+                                  (Named || std::is_empty<P>::value) ? 0u : arm_ };
+        }
+        return r;
+    }
+};
+
+/*
+ * A row of patterns, one for each column of the targets.
+ * P(...) binds a row to the targets & the site of its match, and the bound rows could be
+ * combined by ||, && and !. They are evaluated lazily (row by row, in order) when the condition
+ * of the arm is tested, so that a binding pattern still binds before a later guard reads it.
+*/
+
+template <typename... P>
+struct row
+{
+    std::tuple<P...> ps_;
+
+    template <size_t N, typename Tg, typename S>
+    constexpr auto test(Tg&&, S&) const
+        -> typename std::enable_if<(sizeof...(P) <= N), bool>::type
+    {
+        return true;
+    }
+
+    template <size_t N, typename Tg, typename S>
+    constexpr auto test(Tg&& target, S& st) const
+        -> typename std::enable_if<(sizeof...(P) > N), bool>::type
+    {
+        enum : size_t { C = row_column<P...>(N) };
+        using p_t = type_at<C, P&&...>;
+        if ( st.template apply<C, std::is_lvalue_reference<p_t>::value>(std::get<C>(ps_), 
+                                                                        std::get<C>(std::forward<Tg>(target))) )
+        {
+            return test<N + 1>(std::forward<Tg>(target), st);
+        }
+        return false;
+    }
+};
+
+template <typename... P>
+inline row<P&&...> make_row(P&&... ps)
+{
+    return { std::forward_as_tuple(std::forward<P>(ps)...) };
+}
+
+template <typename T>
+struct is_row_expr : std::false_type {};
+
+template <typename Tg, typename S, typename R>
+struct bound_row
+{
+    Tg& target_;
+    S&  site_;
+    R   row_;
+
+    // The targets are passed as lvalues, since every arm is tested against the same ones.
+    explicit operator bool(void) const
+    {
+        return row_.template test<0>(target_, site_);
+    }
+};
+
+template <typename Tg, typename S, typename R>
+struct is_row_expr<bound_row<Tg, S, R>> : std::true_type {};
+
+template <typename Tg, typename S, typename R>
+inline bound_row<Tg, S, R> bind_row(Tg& target, S& st, R&& r)
+{
+    return { target, st, std::move(r) };
+}
+
+template <typename L, typename R>
+struct row_or
+{
+    L l_;
+    R r_;
+    explicit operator bool(void) const { return static_cast<bool>(l_) || static_cast<bool>(r_); }
+};
+
+template <typename L, typename R>
+struct row_and
+{
+    L l_;
+    R r_;
+    explicit operator bool(void) const { return static_cast<bool>(l_) && static_cast<bool>(r_); }
+};
+
+template <typename T>
+struct row_not
+{
+    T t_;
+    explicit operator bool(void) const { return !static_cast<bool>(t_); }
+};
+
+template <typename L, typename R> struct is_row_expr<row_or <L, R>> : std::true_type {};
+template <typename L, typename R> struct is_row_expr<row_and<L, R>> : std::true_type {};
+template <typename T>             struct is_row_expr<row_not<T>>    : std::true_type {};
+
+template <typename L, typename R>
+inline auto operator||(L&& l, R&& r)
+    -> typename std::enable_if<is_row_expr<underlying<L>>::value && is_row_expr<underlying<R>>::value, 
+                               row_or<underlying<L>, underlying<R>>>::type
+{
+    return { std::forward<L>(l), std::forward<R>(r) };
+}
+
+template <typename L, typename R>
+inline auto operator&&(L&& l, R&& r)
+    -> typename std::enable_if<is_row_expr<underlying<L>>::value && is_row_expr<underlying<R>>::value, 
+                               row_and<underlying<L>, underlying<R>>>::type
+{
+    return { std::forward<L>(l), std::forward<R>(r) };
+}
+
+template <typename T>
+inline auto operator!(T&& t)
+    -> typename std::enable_if<is_row_expr<underlying<T>>::value, row_not<underlying<T>>>::type
+{
+    return { std::forward<T>(t) };
+}
+
+/*
+ * The hot-path match, which rejects the allocating patterns at compile time:
+ *  HotMatch(targets...)
+ *  {
+ *      Case(C<event_t>(1, _, Range(0.5, 1.0))) ...
+ *      Case(Regex("a+"))                       ... // error: an allocating pattern
+ *  }
+ *  EndMatch
+ * The conditions written as plain bool expressions (e.g. the guards) aren't checked.
+*/
+
+template <typename T>
+struct is_alloc_free_expr : std::true_type {};
+template <typename Tg, typename S, typename... P>
+struct is_alloc_free_expr<bound_row<Tg, S, row<P...>>> : all_of<is_alloc_free<underlying<P>>...> {};
+template <typename L, typename R>
+struct is_alloc_free_expr<row_or<L, R>>  : std::integral_constant<bool, is_alloc_free_expr<L>::value && is_alloc_free_expr<R>::value> {};
+template <typename L, typename R>
+struct is_alloc_free_expr<row_and<L, R>> : std::integral_constant<bool, is_alloc_free_expr<L>::value && is_alloc_free_expr<R>::value> {};
+template <typename T>
+struct is_alloc_free_expr<row_not<T>>    : is_alloc_free_expr<T> {};
+
+template <size_t N = 8>
+class hot_site : public site<N>
+{
+public:
+    template <typename E>
+    bool test(const E& cond)
+    {
+        static_assert(is_alloc_free_expr<E>::value, 
+                      "HotMatch: a pattern of this arm could allocate (see match::is_alloc_free).");
+        return static_cast<bool>(cond);
+    }
+};
+
+/*
+ * The memoized match, for the immutable (e.g. hash-consed) targets matched again and again:
+ *  MemoMatch(key, targets...)
+ *  {
+ *      Case(...) ...
+ *  }
+ *  EndMatch
+ * The key is the identity (a pointer) or a hash (an integer) of the targets, and the index of
+ * the winning arm is cached for it, by the match site & the key, in a bounded per-thread cache.
+ * On a hit, the other arms are skipped, and the winning arm is taken without being tested if its
+ * condition is a pure row expression. An arm binding variables is tested again (it would match,
+ * since the targets are immutable), which binds them again. A plain guard is still evaluated, and
+ * if it fails, the arms after it are tested as usual. So an arm is only cached when no arm before
+ * it has a plain guard (which might pass the next time), and "no arm" only when none has one.
+ *
+ * The cache is set-associative, and each set evicts by CLOCK (second chance). A key should not
+ * be reused for other targets (e.g. a freed node address) without calling memo_clear().
+*/
+
+#ifndef MATCH_MEMO_SETS
+#define MATCH_MEMO_SETS 1024 // the sets of the per-thread cache, a power of 2
+#endif
+
+template <typename T>
+struct is_pure_expr : std::false_type {};
+template <typename Tg, typename S, typename... P>
+struct is_pure_expr<bound_row<Tg, S, row<P...>>> : all_of<is_pure<underlying<P>>...> {};
+template <typename L, typename R>
+struct is_pure_expr<row_or<L, R>>  : std::integral_constant<bool, is_pure_expr<L>::value && is_pure_expr<R>::value> {};
+template <typename L, typename R>
+struct is_pure_expr<row_and<L, R>> : std::integral_constant<bool, is_pure_expr<L>::value && is_pure_expr<R>::value> {};
+template <typename T>
+struct is_pure_expr<row_not<T>>    : is_pure_expr<T> {};
+
+struct memo_stats
+{
+    size_t hits_, misses_, evictions_;
+};
+
+class memo_cache
+{
+    enum : size_t { ways = 4, sets = MATCH_MEMO_SETS };
+    static_assert((sets & (sets - 1)) == 0, "MATCH_MEMO_SETS should be a power of 2.");
+
+    struct entry
+    {
+        const void*    site_;
+        std::uintptr_t key_;
+        unsigned       arm_;
+        bool           ref_;
+    };
+
+    struct set
+    {
+        entry    ways_[ways];
+        unsigned hand_;
+    };
+
+    std::unique_ptr<set[]> sets_;
+    memo_stats             stats_ {};
+
+    set& set_of(const void* site, std::uintptr_t key)
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(key) ^ reinterpret_cast<std::uintptr_t>(site);
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdull; // the finalizer of MurmurHash3
+        h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ull;
+        return sets_[static_cast<size_t>(h ^ (h >> 33)) & (sets - 1)];
+    }
+
+public:
+    memo_cache(void) : sets_(new set[sets]()) {}
+
+    static memo_cache& local(void)
+    {
+        static thread_local memo_cache cache;
+        return cache;
+    }
+
+    // Returns the cached arm, or 0 for a miss (the arms are counted from 1).
+
+    unsigned find(const void* site, std::uintptr_t key)
+    {
+        set& s = set_of(site, key);
+        for (auto& e : s.ways_)
+        {
+            if ((e.site_ == site) && (e.key_ == key))
+            {
+                e.ref_ = true;
+                ++stats_.hits_;
+                return e.arm_;
+            }
+        }
+        ++stats_.misses_;
+        return 0;
+    }
+
+    void insert(const void* site, std::uintptr_t key, unsigned arm)
+    {
+        set& s = set_of(site, key);
+        for (auto& e : s.ways_)
+        {
+            if (e.site_ != nullptr) continue;
+            e = { site, key, arm, false };
+            return;
+        }
+        for (;;)
+        {
+            entry& e = s.ways_[s.hand_];
+            s.hand_ = (s.hand_ + 1) % ways;
+            if (e.ref_)
+            {
+                e.ref_ = false;
+                continue;
+            }
+            ++stats_.evictions_;
+            e = { site, key, arm, false };
+            return;
+        }
+    }
+
+    void clear(void)
+    {
+        for (size_t i = 0; i < sets; ++i) sets_[i] = set {};
+        stats_ = {};
+    }
+
+    const memo_stats& stats(void) const { return stats_; }
+};
+
+inline memo_stats memo_statistics(void) { return memo_cache::local().stats(); }
+inline void       memo_clear(void)      { memo_cache::local().clear(); }
+
+template <typename T>
+inline std::uintptr_t memo_key(const T* p) { return reinterpret_cast<std::uintptr_t>(p); }
+
+template <typename T>
+inline auto memo_key(T h)
+    -> typename std::enable_if<std::is_integral<T>::value, std::uintptr_t>::type
+{
+    return static_cast<std::uintptr_t>(h);
+}
+
+template <size_t N = 8>
+class memo_site : public site<N>
+{
+    memo_cache&    cache_;
+    const void*    site_;
+    std::uintptr_t key_;
+    unsigned       hit_;      // the cached arm (unsigned(-1) for none), or 0 for a miss
+    unsigned       arm_ = 0;
+    bool           done_ = false;
+    bool           guarded_ = false; // an arm with a plain guard has failed, so a later one isn't cached
+
+public:
+    memo_site(const void* site, std::uintptr_t key)
+        : cache_(memo_cache::local()), site_(site), key_(key), hit_(cache_.find(site, key))
+    {}
+
+    memo_site(const memo_site&) = delete;
+    memo_site& operator=(const memo_site&) = delete;
+
+    // Records "none" when no arm has been taken.
+    ~memo_site(void)
+    {
+        if ((hit_ == 0) && !done_ && !guarded_) cache_.insert(site_, key_, unsigned(-1));
+    }
+
+    bool begin_arm(void)
+    {
+        ++arm_;
+        site<N>::begin_arm();
+        return (hit_ == 0) || (hit_ == arm_);
+    }
+
+    template <typename E>
+    bool test(const E& cond)
+    {
+        if ((hit_ != 0) && is_pure_expr<E>::value) return true;
+        bool r = static_cast<bool>(cond);
+        if (hit_ != 0)
+        {
+            // The guard of the cached arm has failed this time, so the arms after it are tested
+            // (the ones before it are guard-free, and have failed for these targets).
+            if (!r) hit_ = 0, guarded_ = true;
+            return r;
+        }
+        if (r)
+        {
+            if (!guarded_) cache_.insert(site_, key_, arm_);
+            done_ = true;
+        }
+        else guarded_ = guarded_ || !is_row_expr<E>::value;
+        return r;
+    }
+};
+
+/*
+ * A match dispatched by the dynamic types of its targets (e.g. the collisions, the binary operators):
+ *  TypeMatch(lhs, rhs)
+ *  {
+ *      Case(Type(circle), Type(circle)) ...
+ *      Case(Type(circle), Type(rect))   ...
+ *      Case(_, _)                       ...
+ *  }
+ *  EndMatch
+ *
+ * The winning arm of each combination of the dynamic types (by typeid, or by the IDs of a sealed
+ * hierarchy) is cached in a table of the site, which is shared by all the threads and lock-free.
+ * On a hit, the arm is taken without testing any arm. Only the arms of the type patterns & wildcards
+ * could be cached; once an arm of any other pattern is tested before the winning one, that result
+ * isn't cached, so the first matched arm still wins. The table is filled lazily, and when it's full,
+ * the other combinations are matched as a plain Match.
+*/
+
+#ifndef MATCH_TYPE_CACHE_SIZE
+#define MATCH_TYPE_CACHE_SIZE 64 // the entries of the table of a TypeMatch site, a power of 2
+#endif
+
+template <typename T>
+struct is_type_pattern : std::false_type {};
+template <>
+struct is_type_pattern<wildcard> : std::true_type {};
+template <typename T, bool Cond>
+struct is_type_pattern<type<T, Cond>> : std::true_type {};
+
+template <typename T>
+struct is_type_expr : std::false_type {};
+template <typename Tg, typename S, typename... P>
+struct is_type_expr<bound_row<Tg, S, row<P...>>> : all_of<is_type_pattern<underlying<P>>...> {};
+template <typename L, typename R>
+struct is_type_expr<row_or<L, R>>  : std::integral_constant<bool, is_type_expr<L>::value && is_type_expr<R>::value> {};
+template <typename L, typename R>
+struct is_type_expr<row_and<L, R>> : std::integral_constant<bool, is_type_expr<L>::value && is_type_expr<R>::value> {};
+template <typename T>
+struct is_type_expr<row_not<T>>    : is_type_expr<T> {};
+
+// The dynamic type of a target (looked through a pointer or a smart pointer), or 0 for a null one.
+// It's the ID of a sealed class (see MATCH_SEALED), which needs no RTTI, or the address of its typeid.
+
+template <typename T>
+inline auto type_key(const T& tar)
+    -> typename std::enable_if<sealed_class<class_of<T>>::value, std::uintptr_t>::type
+{
+    auto p = addr(tar);
+    return (p != nullptr) ? static_cast<std::uintptr_t>(p->match_class_id()) + 1 : 0;
+}
+
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+template <typename T>
+inline auto type_key(const T& tar)
+    -> typename std::enable_if<!sealed_class<class_of<T>>::value, std::uintptr_t>::type
+{
+    auto p = addr(tar);
+    return (p != nullptr) ? reinterpret_cast<std::uintptr_t>(&typeid(*p)) : 0;
+}
+#endif
+
+template <size_t K>
+class type_cache
+{
+    enum : size_t { size = MATCH_TYPE_CACHE_SIZE };
+    static_assert((size & (size - 1)) == 0, "MATCH_TYPE_CACHE_SIZE should be a power of 2.");
+
+public:
+    using key_t = std::array<std::uintptr_t, K>;
+
+private:
+    struct entry
+    {
+        key_t    key_;
+        unsigned arm_;
+    };
+
+    // An entry is written once, before it's published by a release store of its slot.
+
+    entry                      entries_[size];
+    std::atomic<const entry*>  slots_[size];
+    std::atomic<size_t>        used_;
+
+    static size_t hash(const key_t& key)
+    {
+        std::uint64_t h = 0;
+        for (auto t : key)
+        {
+            h ^= t + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        }
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdull;
+        return static_cast<size_t>(h ^ (h >> 33));
+    }
+
+public:
+    // Returns the cached arm, or 0 for a miss (the arms are counted from 1).
+
+    unsigned find(const key_t& key) const
+    {
+        for (size_t i = 0, h = hash(key); i < size; ++i)
+        {
+            const entry* e = slots_[(h + i) & (size - 1)].load(std::memory_order_acquire);
+            if (e == nullptr)    return 0;
+            if (e->key_ == key)  return e->arm_;
+        }
+        return 0;
+    }
+
+    // A full cache, or a key inserted already (e.g. by another thread missing it at the same time),
+    // is found before claiming an entry, so that it costs no atomic RMW nor any entry.
+
+    void insert(const key_t& key, unsigned arm)
+    {
+        if ((used_.load(std::memory_order_relaxed) >= size) || (find(key) != 0)) return;
+        size_t n = used_.fetch_add(1, std::memory_order_relaxed);
+        if (n >= size) return;
+        entry* e = &entries_[n];
+        *e = { key, arm };
+        for (size_t i = 0, h = hash(key); i < size; ++i)
+        {
+            const entry* empty = nullptr;
+            auto& slot = slots_[(h + i) & (size - 1)];
+            if (slot.compare_exchange_strong(empty, e, std::memory_order_release, std::memory_order_acquire)) return;
+            if (empty->key_ == key) return; // inserted by another thread
+        }
+    }
+};
+
+template <typename... T, size_t... I>
+inline typename type_cache<sizeof...(T)>::key_t type_keys(const std::tuple<T...>& tar, std::index_sequence<I...>)
+{
+    return {{ type_key(std::get<I>(tar))... }};
+}
+
+template <typename... T>
+inline typename type_cache<sizeof...(T)>::key_t type_keys(const std::tuple<T...>& tar)
+{
+    return type_keys(tar, std::index_sequence_for<T...>{});
+}
+
+template <class Cache, size_t N = 8>
+class type_site : public site<N>
+{
+    Cache&                  cache_;
+    typename Cache::key_t   key_;
+    unsigned                hit_;          // the cached arm (unsigned(-1) for none), or 0 for a miss
+    unsigned                arm_   = 0;
+    bool                    typed_ = true; // all the arms tested are of the type patterns
+    bool                    done_  = false;
+
+public:
+    template <typename Tg>
+    type_site(Cache& cache, const Tg& tar)
+        : cache_(cache), key_(type_keys(tar)), hit_(cache.find(key_))
+    {}
+
+    type_site(const type_site&) = delete;
+    type_site& operator=(const type_site&) = delete;
+
+    // Records "none" when no arm has been taken.
+    ~type_site(void)
+    {
+        if ((hit_ == 0) && !done_ && typed_) cache_.insert(key_, unsigned(-1));
+    }
+
+    bool begin_arm(void)
+    {
+        ++arm_;
+        site<N>::begin_arm();
+        return (hit_ == 0) || (hit_ == arm_);
+    }
+
+    template <typename E>
+    bool test(const E& cond)
+    {
+        if (hit_ != 0) return true;
+        bool r = static_cast<bool>(cond);
+        typed_ = typed_ && is_type_expr<E>::value;
+        if (r)
+        {
+            if (typed_) cache_.insert(key_, arm_);
+            done_ = true;
+        }
+        return r;
+    }
+};
+
+/*
+ * The expression form of a match, giving the result of the first matched arm:
+ *  auto r = match::when(x, y)(case_(1, _) >>= a, case_(_, Range(2, 9)) >>= b, case_(_, _) >>= c);
+ * The type of the result is the common type of the arms, and it's value-initialized when
+ * no arm matches. A callable result (e.g. a lambda) is only called when its arm is chosen,
+ * which should be used for the results reading the variables bound by the patterns.
+ *
+ * A when() could be evaluated in a constant expression (e.g. to build a lookup table at compile
+ * time), if its targets, patterns and results could be: the constants, wildcards, ranges, sets,
+ * the sequences on std::array and the constructors on the types given by MATCH_REGIST_MEMBERS.
+ * Unlike a Match, it doesn't memoize the repeated patterns of its arms.
+ *
+ * When every arm is pure & cheap (constants, ranges, sets, bits and wildcards, see "pattern_cost")
+ * on the plain-value targets, and the results are plain values, all the arms are evaluated and
+ * the result is picked by a chain of selects, which compiles to conditional moves instead of
+ * the branches mispredicted on the unpredictable inputs.
 */
 
-template <typename T = wildcard, typename... P>
-inline auto C(P&&... args)
-    -> constructor<T, decltype(filter(std::forward<P>(args)))...>
+template <typename... P>
+constexpr auto case_(P&&... args)
+    -> row<decltype(filter(std::forward<P>(args)))...>
 {
-    return { filter(std::forward<P>(args))... };
+    using tp_t = std::tuple<decltype(filter(std::forward<P>(args)))...>;
+    return { tp_t(filter(std::forward<P>(args))...) };
+}
+
+template <typename R, typename V>
+struct arm
+{
+    R   row_;
+    V&& v_;
+};
+
+template <typename... P, typename V>
+constexpr arm<row<P...>, V> operator>>=(row<P...>&& r, V&& v)
+{
+    return { std::move(r), std::forward<V>(v) };
 }
 
+template <typename V, typename = void>
+struct arm_value
+{
+    using type = typename std::decay<V>::type;
+    static constexpr V&& get(V&& v) { return std::forward<V>(v); }
+};
+
+template <typename V>
+struct arm_value<V, decltype(void(std::declval<V&>()()))>
+{
+    using type = typename std::decay<decltype(std::declval<V&>()())>::type;
+    static constexpr type get(V&& f) { return f(); }
+};
+
+// A row of the cheap patterns only, which could be evaluated without a short-circuit.
+
+template <typename R>
+struct is_cheap_row : std::false_type {};
 template <typename... P>
-inline auto S(P&&... args)
-    -> sequence<decltype(filter(std::forward<P>(args)))...>
+struct is_cheap_row<row<P...>> : all_of<std::integral_constant<bool, (column_cost<underlying<P>>::value <= cost_constant)>...> {};
+
+template <typename A>
+struct arm_traits;
+
+template <typename... P, typename V>
+struct arm_traits<arm<row<P...>, V>>
 {
-    return { filter(std::forward<P>(args))... };
+    using value_t = arm_value<V>;
+    using type    = typename value_t::type;
+
+    enum : bool
+    {
+        selectable = is_cheap_row<row<P...>>::value && std::is_same<typename std::decay<V>::type, type>::value
+    };
+};
+
+// Selects by a mask for the integers, since a compiler would rather branch on a plain ?:.
+
+template <typename R>
+constexpr auto select_value(bool c, R x, R y)
+    -> typename std::enable_if<std::is_integral<R>::value && !std::is_same<R, bool>::value, R>::type
+{
+    using u_t = typename std::make_unsigned<R>::type;
+    u_t m = u_t(0) - static_cast<u_t>(c);
+    return static_cast<R>((static_cast<u_t>(x) & m) | (static_cast<u_t>(y) & ~m));
+}
+
+template <typename R>
+constexpr auto select_value(bool c, R x, R y)
+    -> typename std::enable_if<!std::is_integral<R>::value || std::is_same<R, bool>::value, R>::type
+{
+    return c ? x : y;
+}
+
+// The site of a when(), which doesn't memoize the patterns, so that it could be constexpr.
+
+struct plain_site
+{
+    constexpr bool begin_arm(void) const { return true; }
+
+    template <size_t Col, bool Named, typename P, typename U>
+    constexpr bool apply(const P& pat, U&& tar) const
+    {
+        return pat(std::forward<U>(tar));
+    }
+};
+
+template <typename... T>
+class when_t
+{
+    std::tuple<T...> target_;
+
+    template <typename R, typename S>
+    static constexpr R first(std::tuple<T...>&, S&)
+    {
+        return R();
+    }
+
+    template <typename R, typename S, typename A1, typename... A>
+    static constexpr R first(std::tuple<T...>& tar, S& st, A1& a1, A&... arms)
+    {
+        if (st.begin_arm() && a1.row_.template test<0>(tar, st))
+        {
+            return arm_traits<A1>::value_t::get(std::forward<decltype(a1.v_)>(a1.v_));
+        }
+        return first<R>(tar, st, arms...);
+    }
+
+    // Evaluates all the columns of a row, without a short-circuit.
+
+    template <typename... P, size_t... I>
+    constexpr bool test_all(const row<P...>& r, std::index_sequence<I...>)
+    {
+        bool ok = true;
+        using expand = bool[];
+        (void)expand { (ok = ok & static_cast<bool>(std::get<I>(r.ps_)(std::get<I>(target_))))..., true };
+        return ok;
+    }
+
+    template <typename R>
+    constexpr R select(void)
+    {
+        return R();
+    }
+
+    template <typename R, typename A1, typename... A>
+    constexpr R select(A1& a1, A&... arms)
+    {
+        R r = select<R>(arms...);
+        R v = static_cast<R>(a1.v_);
+        return select_value(test_all(a1.row_, std::make_index_sequence<sizeof...(T)>{}), v, r);
+    }
+
+    template <typename R, typename... A>
+    constexpr auto pick(std::true_type, A&... arms) -> R
+    {
+        return select<R>(arms...);
+    }
+
+    template <typename R, typename... A>
+    constexpr auto pick(std::false_type, A&... arms) -> R
+    {
+        plain_site st;
+        return first<R>(target_, st, arms...);
+    }
+
+public:
+    constexpr explicit when_t(std::tuple<T...>&& tar) : target_(std::move(tar)) {}
+
+    template <typename... A>
+    constexpr auto operator()(A&&... arms)
+        -> typename std::common_type<typename arm_traits<underlying<A>>::type...>::type
+    {
+        using r_t = typename std::common_type<typename arm_traits<underlying<A>>::type...>::type;
+        using select_t = std::integral_constant<bool, 
+            all_of<std::integral_constant<bool, arm_traits<underlying<A>>::selectable>...>::value &&
+            all_of<is_plain_value<underlying<T>>...>::value && is_plain_value<r_t>::value>;
+        return pick<r_t>(select_t{}, arms...);
+    }
+};
+
+template <typename... T>
+constexpr when_t<T...> when(T&&... args)
+{
+    return when_t<T...>(capture(std::forward<T>(args)...));
+}
+
+/*
+ * The match-all form, giving every matched arm rather than only the first one:
+ *  auto fired = match::all(ev)(case_(C<event_t>(1, _, _)), case_(C<event_t>(_, "disk", _)), case_(_));
+ *  // fired[i] tells whether the i-th arm matches
+ *
+ * All the arms share a site, so a (memoized) pattern repeated by several arms in a column is
+ * evaluated once. The arms of the cheap patterns on the plain values are evaluated without
+ * a branch (see when()). A run of the arms testing the first column against the integer literals
+ * (Lit(...)) of its type is ruled out by one range test, when the column is out of their range.
+*/
+
+template <typename P>
+struct literal_of
+{
+    using type = void;
+
+    template <typename L>
+    static constexpr L value(void) { return L(); }
+};
+
+template <typename T, T V>
+struct literal_of<literal<T, V>>
+{
+    using type = T;
+
+    template <typename L>
+    static constexpr L value(void) { return V; }
+};
+
+template <typename R>
+struct head_literal : literal_of<void> {};
+template <typename P1, typename... P>
+struct head_literal<row<P1, P...>> : literal_of<underlying<P1>> {};
+
+// The site of a match::all(), which memoizes only the patterns repeated (by their types) in a column
+// of its arms, and compares them by their types rather than through a function pointer.
+
+template <typename... R>
+class all_site
+{
+    template <size_t Col, typename Rw, typename = void>
+    struct column_of { using type = void; };
+    template <size_t Col, typename... P>
+    struct column_of<Col, row<P...>, typename std::enable_if<(Col < sizeof...(P))>::type>
+    {
+        using type = underlying<type_at<Col, P...>>;
+    };
+
+    template <size_t Col, typename P>
+    static constexpr size_t count(void)
+    {
+        const bool same[] = { std::is_same<typename column_of<Col, R>::type, P>::value..., false };
+        size_t n = 0;
+        for (bool b : same) n += b ? 1 : 0;
+        return n;
+    }
+
+    // A stateful constructor (or sequence) costs as much to compare with another one as to be tested,
+    // so only the stateless patterns & the expensive ones are shared.
+
+    template <size_t Col, typename P>
+    struct is_shared : std::integral_constant<bool, is_memoized<P>::value && (count<Col, P>() > 1) && 
+                                                    (std::is_empty<P>::value || (pattern_cost<P>::value > cost_constructor))> {};
+
+    // The number of the patterns shared in the columns of a row.
+
+    template <typename Rw>
+    struct shared_in : std::integral_constant<size_t, 0> {};
+
+    template <typename... P>
+    struct shared_in<row<P...>>
+    {
+        template <size_t... I>
+        static constexpr size_t count(std::index_sequence<I...>)
+        {
+            const bool shared[] = { is_shared<I, underlying<P>>::value..., false };
+            size_t n = 0;
+            for (bool b : shared) n += b ? 1 : 0;
+            return n;
+        }
+
+        enum : size_t { value = count(std::index_sequence_for<P...>{}) };
+    };
+
+    // Sized by the shared patterns of the arms (up to 64, a bit each), rather than a fixed capacity,
+    // since a large frame keeps the compiler from inlining the whole match-all into its caller.
+
+    template <typename... Rw>
+    static constexpr size_t shared_count(void)
+    {
+        const size_t ns[] = { shared_in<Rw>::value..., 0 };
+        size_t n = 0;
+        for (size_t k : ns) n += k;
+        return (n < 64) ? n : 64;
+    }
+
+    enum : size_t { capacity = shared_count<R...>() };
+
+    struct entry
+    {
+        size_t      column_;
+        const void* tag_;
+        const void* pattern_;
+    };
+
+    entry         entries_[(capacity > 0) ? capacity : 1];
+    std::uint64_t results_ = 0; // the result of each entry, by its bit
+    size_t        size_    = 0;
+
+public:
+    bool begin_arm(void) const { return true; }
+
+    template <size_t Col, bool Named, typename P, typename U>
+    auto apply(const P& pat, U&& tar)
+        -> typename std::enable_if<!is_shared<Col, P>::value, bool>::type
+    {
+        return pat(std::forward<U>(tar));
+    }
+
+    template <size_t Col, bool Named, typename P, typename U>
+    auto apply(const P& pat, U&& tar)
+        -> typename std::enable_if<is_shared<Col, P>::value, bool>::type
+    {
+        const void* tag = &pattern_tag<P>::id_;
+        for (size_t i = 0; i < size_; ++i)
+        {
+            const entry& e = entries_[i];
+            if ((e.column_ == Col) && (e.tag_ == tag) && 
+                (std::is_empty<P>::value || same_pattern(*static_cast<const P*>(e.pattern_), pat)))
+            {
+                return ((results_ >> i) & 1) != 0;
+            }
+        }
+        bool r = pat(std::forward<U>(tar));
+        if (size_ < capacity)
+        {
+            results_ |= static_cast<std::uint64_t>(r) << size_;
+            entries_[size_++] = { Col, tag, std::addressof(pat) };
+        }
+        return r;
+    }
+};
+
+template <typename... T>
+class all_t
+{
+    std::tuple<T...> target_;
+
+    template <typename A>
+    using head_t = typename head_literal<underlying<A>>::type;
+
+    // The number of the arms from the I-th one, testing the literals of the same type in the first column.
+
+    template <size_t I, typename... A>
+    static constexpr size_t run_size(void)
+    {
+        const bool same[] = { std::is_same<head_t<A>, head_t<type_at<I, A...>>>::value..., false };
+        size_t n = 0;
+        while (same[I + n]) ++n;
+        return n;
+    }
+
+    template <bool InRange, size_t I, typename... A>
+    struct is_run_ : std::false_type {};
+    template <size_t I, typename... A>
+    struct is_run_<true, I, A...> : std::integral_constant<bool, 
+        std::is_integral<head_t<type_at<I, A...>>>::value &&
+        std::is_same<head_t<type_at<I, A...>>, underlying<type_at<0, T...>>>::value && (run_size<I, A...>() > 1)> {};
+
+    template <size_t I, typename... A>
+    using is_run = is_run_<(I < sizeof...(A)), I, A...>;
+
+    template <size_t I, size_t N, typename L, typename... A>
+    static constexpr L run_bound(bool hi)
+    {
+        const L vs[] = { head_literal<underlying<A>>::template value<L>()... };
+        L b = vs[I];
+        for (size_t i = I + 1; i < I + N; ++i)
+        {
+            if (hi ? (b < vs[i]) : (vs[i] < b)) b = vs[i];
+        }
+        return b;
+    }
+
+    template <typename S, typename... P, size_t... I>
+    bool test_all(const row<P...>& r, S&, std::index_sequence<I...>, std::true_type)
+    {
+        bool ok = true;
+        using expand = bool[];
+        (void)expand { (ok = ok & static_cast<bool>(std::get<I>(r.ps_)(std::get<I>(target_))))..., true };
+        return ok;
+    }
+
+    template <typename S, typename... P, size_t... I>
+    bool test_all(const row<P...>& r, S& st, std::index_sequence<I...>, std::false_type)
+    {
+        return r.template test<0>(target_, st);
+    }
+
+    template <size_t I, typename B, typename S, typename... A>
+    void test(B& bits, S& st, std::tuple<A&...>& arms)
+    {
+        using cheap_t = std::integral_constant<bool, 
+            is_cheap_row<underlying<type_at<I, A...>>>::value && all_of<is_plain_value<underlying<T>>...>::value>;
+        st.begin_arm();
+        bits.set(I, test_all(std::get<I>(arms), st, std::make_index_sequence<sizeof...(T)>{}, cheap_t{}));
+    }
+
+    template <size_t I, typename B, typename S, typename... A>
+    auto apply(B&, S&, std::tuple<A&...>&)
+        -> typename std::enable_if<(I >= sizeof...(A))>::type
+    {}
+
+    template <size_t I, typename B, typename S, typename... A>
+    auto apply(B& bits, S& st, std::tuple<A&...>& arms)
+        -> typename std::enable_if<(I < sizeof...(A)) && !is_run<I, A...>::value>::type
+    {
+        test<I>(bits, st, arms);
+        apply<I + 1>(bits, st, arms);
+    }
+
+    template <size_t I, size_t... J, typename B, typename S, typename... A>
+    void apply_run(B& bits, S& st, std::tuple<A&...>& arms, std::index_sequence<J...>)
+    {
+        using expand = int[];
+        (void)expand { (test<I + J>(bits, st, arms), 0)... };
+    }
+
+    template <size_t I, typename B, typename S, typename... A>
+    auto apply(B& bits, S& st, std::tuple<A&...>& arms)
+        -> typename std::enable_if<(I < sizeof...(A)) && is_run<I, A...>::value>::type
+    {
+        enum : size_t { n = run_size<I, A...>() };
+        using lit_t = head_t<type_at<I, A...>>;
+        constexpr lit_t lo = run_bound<I, n, lit_t, A...>(false);
+        constexpr lit_t hi = run_bound<I, n, lit_t, A...>(true);
+        const auto& x = std::get<0>(target_);
+        if (!(x < lo) && !(hi < x))
+        {
+            apply_run<I>(bits, st, arms, std::make_index_sequence<n>{});
+        }
+        apply<I + n>(bits, st, arms);
+    }
+
+public:
+    explicit all_t(std::tuple<T...>&& tar) : target_(std::move(tar)) {}
+
+    template <typename... A>
+    std::bitset<sizeof...(A)> operator()(A&&... arms)
+    {
+        std::bitset<sizeof...(A)> bits;
+        all_site<underlying<A>...> st;
+        std::tuple<A&...> as(arms...);
+        apply<0>(bits, st, as);
+        return bits;
+    }
+};
+
+template <typename... T>
+inline all_t<T...> all(T&&... args)
+{
+    return all_t<T...>(capture(std::forward<T>(args)...));
 }
 
 } // namespace match
 
-#define Match(...)                                         \
-    {                                                      \
-        auto target_ = std::forward_as_tuple(__VA_ARGS__); \
+// The probes of the match sites (see match/probes.hpp), which are compiled away unless it's 1.
+
+#ifndef MATCH_PROBES
+#define MATCH_PROBES 0
+#endif
+
+#if MATCH_PROBES
+#   include "match/probes.hpp"
+#else
+#   define MATCH_PROBE_SITE_()
+#   define MATCH_PROBE_ARM_()
+#endif
+
+#define Match(...)                                  \
+    {                                               \
+        auto target_ = match::capture(__VA_ARGS__); \
+        match::site<> site_;                        \
+        MATCH_PROBE_SITE_()                         \
+        if (false)
+
+#define HotMatch(...)                               \
+    {                                               \
+        auto target_ = match::capture(__VA_ARGS__); \
+        match::hot_site<> site_;                    \
+        MATCH_PROBE_SITE_()                         \
+        if (false)
+
+#define MemoMatch(KEY, ...)                                                   \
+    {                                                                         \
+        auto target_ = match::capture(__VA_ARGS__);                           \
+        static const char memo_tag_ = 0;                                      \
+        match::memo_site<> site_(&memo_tag_, match::memo_key(KEY));           \
+        MATCH_PROBE_SITE_()                                                   \
+        if (false)
+
+#define TypeMatch(...)                                                                            \
+    {                                                                                             \
+        auto target_ = match::capture(__VA_ARGS__);                                               \
+        static match::type_cache<std::tuple_size<decltype(target_)>::value> type_cache_;          \
+        match::type_site<decltype(type_cache_)> site_(type_cache_, target_);                      \
+        MATCH_PROBE_SITE_()                                                                       \
         if (false)
 
-#define MATCH_CASE_ARG_(N, ...) && ( match::filter( CAPO_PP_A_(N, __VA_ARGS__) )( std::get<N - 1>(std::move(target_)) ) )
-#define P(...)                  ( true CAPO_PP_REPEAT_(CAPO_PP_COUNT_(__VA_ARGS__), MATCH_CASE_ARG_, __VA_ARGS__) )
+#define MATCH_CASE_ARG_(N, ...) , match::filter( CAPO_PP_A_(N, __VA_ARGS__) )
+#define P(...)                  match::bind_row(target_, site_, match::make_row(CAPO_PP_B_1_( \
+                                    CAPO_PP_REPEAT_(CAPO_PP_COUNT_(__VA_ARGS__), MATCH_CASE_ARG_, __VA_ARGS__))))
 
 #define With(...) \
-        } else if (__VA_ARGS__) {
+        } else if (site_.begin_arm() && site_.test(__VA_ARGS__)) { MATCH_PROBE_ARM_()
 
 #define Case(...) With( P(__VA_ARGS__) )
 
 #define Otherwise() \
-        } else {
+        } else { MATCH_PROBE_ARM_()
 
 #define EndMatch \
     }
@@ -0,0 +1,326 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include "match.hpp"
+
+#include <limits>  // std::numeric_limits
+#include <cmath>   // std::ceil, std::floor, std::nextafter
+#include <cstdint> // std::int32_t, std::uint8_t
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#   include <immintrin.h>
+#   define MATCH_BATCH_X86_ 1
+#   define MATCH_BATCH_TARGET_(ISA) __attribute__((target(ISA)))
+#else
+#   define MATCH_BATCH_X86_ 0
+#endif
+
+namespace match {
+
+/*
+ * The batch classification of a column of scalars, with a case table of one-column arms:
+ *  auto table = match::batch<float>(case_(0.f), case_(Range(0.f, 1.f)), case_(_));
+ *  table(xs, n, out); // out[i] is the index of the first arm matching xs[i], or table.size()
+ *
+ * Only the wildcards, constants (and literals) and ranges could be in the table. Each arm is normalized into
+ * a closed interval of the element type (an empty one never matches), plus whether it matches
+ * a NaN, as the scalar patterns do. The vectorized kernels apply the arms from the last one to
+ * the first, each one overwriting the index of the lanes it matches, so the first match wins.
+ * The int32 & float columns are vectorized with SSE2 or AVX2, chosen by the CPU at runtime,
+ * and their tails use the same branch-free selection. The other columns (or all of them with
+ * simd::none) use a scalar cascade, which stops at the first matching arm as a Match does.
+*/
+
+enum class simd
+{
+    none, sse2, avx2
+};
+
+inline simd simd_level(void)
+{
+#if MATCH_BATCH_X86_
+    static const simd level = []
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return simd::avx2;
+        if (__builtin_cpu_supports("sse2")) return simd::sse2;
+        return simd::none;
+    }();
+    return level;
+#else
+    return simd::none;
+#endif
+}
+
+// Rounds a bound into the element type: up for a lower bound, down for an upper one.
+
+template <typename T>
+inline T batch_bound(long double v, bool up, bool& empty)
+{
+    using lim = std::numeric_limits<T>;
+    if (v != v)
+    {
+        empty = true;
+        return T();
+    }
+    if (std::is_integral<T>::value)
+    {
+        v = up ? std::ceil(v) : std::floor(v);
+        if (v < static_cast<long double>(lim::lowest())) { empty = empty || !up; return lim::lowest(); }
+        if (v > static_cast<long double>(lim::max()))    { empty = empty ||  up; return lim::max(); }
+        return static_cast<T>(v);
+    }
+    T t = static_cast<T>(v);
+    if ( up && (static_cast<long double>(t) < v)) t = static_cast<T>(std::nextafter(t,  lim::infinity()));
+    if (!up && (static_cast<long double>(t) > v)) t = static_cast<T>(std::nextafter(t, -lim::infinity()));
+    return t;
+}
+
+template <typename T>
+struct batch_arm
+{
+    T    lo_, hi_;
+    bool nan_;
+
+    static T lowest (void) { return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest(); }
+    static T highest(void) { return std::numeric_limits<T>::has_infinity ?  std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max(); }
+
+    static batch_arm interval(long double lo, long double hi, bool nan)
+    {
+        bool empty = false;
+        batch_arm a { batch_bound<T>(lo, true, empty), batch_bound<T>(hi, false, empty), nan };
+        if (empty || (a.hi_ < a.lo_)) a = { highest(), lowest(), nan };
+        return a;
+    }
+
+    static batch_arm make(const wildcard&)
+    {
+        return { lowest(), highest(), true };
+    }
+
+    template <typename U>
+    static batch_arm make(const constant<U>& p)
+    {
+        return interval(static_cast<long double>(p.t_), static_cast<long double>(p.t_), false);
+    }
+
+    template <typename U>
+    static batch_arm make(const value<U>& p)
+    {
+        return interval(static_cast<long double>(p.t_), static_cast<long double>(p.t_), false);
+    }
+
+    template <typename U, U V>
+    static batch_arm make(const literal<U, V>&)
+    {
+        return interval(static_cast<long double>(V), static_cast<long double>(V), false);
+    }
+
+    // As the scalar range, a reversed one is empty and NaN is in no range.
+
+    template <typename U>
+    static batch_arm make(const range<U>& p)
+    {
+        return interval(static_cast<long double>(p.lo_), static_cast<long double>(p.hi_), false);
+    }
+
+    template <typename P>
+    static batch_arm make(const P&)
+    {
+        static_assert(!std::is_same<P, P>::value, "Only the wildcards, constants and ranges are supported by a batch table.");
+        return {};
+    }
+
+    bool operator()(T x) const
+    {
+        return (!(x < lo_) & !(hi_ < x) & (x == x)) | (nan_ & (x != x));
+    }
+};
+
+/*
+ * The vectorized kernels, which return the number of the elements done.
+*/
+
+template <typename T>
+inline size_t batch_sse2(const T*, size_t, std::uint8_t*, const batch_arm<T>*, size_t)
+{
+    return 0;
+}
+
+template <typename T>
+inline size_t batch_avx2(const T*, size_t, std::uint8_t*, const batch_arm<T>*, size_t)
+{
+    return 0;
+}
+
+#if MATCH_BATCH_X86_
+
+MATCH_BATCH_TARGET_("sse2")
+inline void batch_store4(std::uint8_t* out, __m128i r)
+{
+    __m128i p = _mm_packs_epi32(r, r);
+    p = _mm_packus_epi16(p, p);
+    int w = _mm_cvtsi128_si32(p);
+    std::memcpy(out, &w, 4);
+}
+
+MATCH_BATCH_TARGET_("sse2")
+inline size_t batch_sse2(const std::int32_t* xs, size_t n, std::uint8_t* out, const batch_arm<std::int32_t>* arms, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + i));
+        __m128i r = _mm_set1_epi32(static_cast<int>(count));
+        for (size_t a = count; a > 0; --a)
+        {
+            const auto& arm = arms[a - 1];
+            __m128i out_of = _mm_or_si128(_mm_cmpgt_epi32(_mm_set1_epi32(arm.lo_), x),
+                                          _mm_cmpgt_epi32(x, _mm_set1_epi32(arm.hi_)));
+            r = _mm_or_si128(_mm_and_si128(out_of, r), _mm_andnot_si128(out_of, _mm_set1_epi32(static_cast<int>(a - 1))));
+        }
+        batch_store4(out + i, r);
+    }
+    return i;
+}
+
+MATCH_BATCH_TARGET_("sse2")
+inline size_t batch_sse2(const float* xs, size_t n, std::uint8_t* out, const batch_arm<float>* arms, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128  x   = _mm_loadu_ps(xs + i);
+        __m128  nan = _mm_cmpunord_ps(x, x);
+        __m128i r   = _mm_set1_epi32(static_cast<int>(count));
+        for (size_t a = count; a > 0; --a)
+        {
+            const auto& arm = arms[a - 1];
+            __m128 in = _mm_and_ps(_mm_cmpge_ps(x, _mm_set1_ps(arm.lo_)), _mm_cmple_ps(x, _mm_set1_ps(arm.hi_)));
+            if (arm.nan_) in = _mm_or_ps(in, nan);
+            __m128i m = _mm_castps_si128(in);
+            r = _mm_or_si128(_mm_andnot_si128(m, r), _mm_and_si128(m, _mm_set1_epi32(static_cast<int>(a - 1))));
+        }
+        batch_store4(out + i, r);
+    }
+    return i;
+}
+
+MATCH_BATCH_TARGET_("avx2")
+inline void batch_store8(std::uint8_t* out, __m256i r)
+{
+    __m128i p = _mm_packs_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+    p = _mm_packus_epi16(p, p);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), p);
+}
+
+MATCH_BATCH_TARGET_("avx2")
+inline size_t batch_avx2(const std::int32_t* xs, size_t n, std::uint8_t* out, const batch_arm<std::int32_t>* arms, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(xs + i));
+        __m256i r = _mm256_set1_epi32(static_cast<int>(count));
+        for (size_t a = count; a > 0; --a)
+        {
+            const auto& arm = arms[a - 1];
+            __m256i out_of = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(arm.lo_), x),
+                                             _mm256_cmpgt_epi32(x, _mm256_set1_epi32(arm.hi_)));
+            r = _mm256_blendv_epi8(_mm256_set1_epi32(static_cast<int>(a - 1)), r, out_of);
+        }
+        batch_store8(out + i, r);
+    }
+    return i;
+}
+
+MATCH_BATCH_TARGET_("avx2")
+inline size_t batch_avx2(const float* xs, size_t n, std::uint8_t* out, const batch_arm<float>* arms, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256  x   = _mm256_loadu_ps(xs + i);
+        __m256  nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+        __m256i r   = _mm256_set1_epi32(static_cast<int>(count));
+        for (size_t a = count; a > 0; --a)
+        {
+            const auto& arm = arms[a - 1];
+            __m256 in = _mm256_and_ps(_mm256_cmp_ps(x, _mm256_set1_ps(arm.lo_), _CMP_GE_OQ),
+                                      _mm256_cmp_ps(x, _mm256_set1_ps(arm.hi_), _CMP_LE_OQ));
+            if (arm.nan_) in = _mm256_or_ps(in, nan);
+            r = _mm256_blendv_epi8(r, _mm256_set1_epi32(static_cast<int>(a - 1)), _mm256_castps_si256(in));
+        }
+        batch_store8(out + i, r);
+    }
+    return i;
+}
+
+#endif // MATCH_BATCH_X86_
+
+template <typename T, size_t N>
+class batch_table
+{
+    static_assert(N < 255, "A batch table supports up to 254 arms.");
+
+    batch_arm<T> arms_[N];
+
+    // Tests the arms in order and stops at the first match, as a Match does.
+    // Unrolled at compile time, so that the compiler could turn the cascade into conditional moves.
+
+    template <size_t A>
+    std::uint8_t first(T x, std::integral_constant<size_t, A>) const
+    {
+        return arms_[A](x) ? static_cast<std::uint8_t>(A) : first(x, std::integral_constant<size_t, A + 1>{});
+    }
+
+    std::uint8_t first(T, std::integral_constant<size_t, N>) const
+    {
+        return N;
+    }
+
+    // Applies all the arms from the last one to the first, as the vectorized kernels do.
+
+    std::uint8_t select(T x) const
+    {
+        std::uint8_t r = N;
+        for (size_t a = N; a > 0; --a)
+        {
+            r = select_value(arms_[a - 1](x), static_cast<std::uint8_t>(a - 1), r);
+        }
+        return r;
+    }
+
+public:
+    template <typename... A>
+    explicit batch_table(const A&... arms)
+        : arms_{ batch_arm<T>::make(std::get<0>(arms.ps_))... }
+    {}
+
+    size_t size(void) const { return N; }
+
+    // Writes the index of the first arm matching each element (or size() for none).
+
+    void operator()(const T* xs, size_t n, std::uint8_t* out, simd level = simd_level()) const
+    {
+        size_t i = 0;
+        if (level == simd::avx2) i = batch_avx2(xs, n, out, arms_, N);
+        if (level >= simd::sse2) i += batch_sse2(xs + i, n - i, out + i, arms_, N);
+        if (i != 0) for (; i < n; ++i) out[i] = select(xs[i]); // the tail of a vectorized column
+        else        for (; i < n; ++i) out[i] = first(xs[i], std::integral_constant<size_t, 0>{});
+    }
+};
+
+template <typename T, typename... A>
+inline batch_table<T, sizeof...(A)> batch(A&&... arms)
+{
+    static_assert(all_of<std::integral_constant<bool, std::tuple_size<decltype(arms.ps_)>::value == 1>...>::value,
+                  "The arms of a batch table should have one column.");
+    return batch_table<T, sizeof...(A)>(arms...);
+}
+
+} // namespace match
@@ -0,0 +1,270 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include "match.hpp"
+
+#include <vector>        // std::vector
+#include <unordered_map> // std::unordered_map
+#include <functional>    // std::function, std::hash
+#include <algorithm>     // std::sort
+#include <cstdint>       // std::uint32_t
+
+namespace match {
+
+/*
+ * Discrimination net, an index over a large set of constructor-pattern subscriptions on
+ * a registered type (see MATCH_REGIST_TYPE).
+ *
+ * The constant fields of the subscriptions are hashed, and the subscriptions are partitioned
+ * by them into a tree: each node tests the field which leaves the fewest candidates expected,
+ * while the subscriptions not having a constant on that field go to a wildcard branch.
+ * An event only walks its own branches, and the candidates it reaches are checked with their
+ * complete patterns (the residual checks), so a hash collision only costs an extra check.
+*/
+
+template <typename T>
+struct is_hashable_
+{
+    template <typename U> static std::true_type  check(decltype(std::hash<U>{}(std::declval<const U&>()))*);
+    template <typename U> static std::false_type check(...);
+};
+template <typename T>
+using is_hashable = decltype(is_hashable_<T>::template check<T>(nullptr));
+
+template <typename T>
+class dnet
+{
+    using layout_t = typename bindings<T>::layout_t;
+
+    enum : size_t        { fields = layout_t::size };
+    enum : std::uint32_t { npos   = std::uint32_t(-1) };
+
+    using hash_fn = size_t(*)(const T&);
+
+    struct node
+    {
+        size_t field_ = fields; // the field to be tested, or "fields" for a leaf
+        std::unordered_map<size_t, std::uint32_t> kids_;
+        std::uint32_t wild_ = npos;
+        std::vector<std::uint32_t> subs_;
+    };
+
+    std::vector<std::function<bool(const T&)>> tests_;
+    std::vector<bool>   has_; // [sub * fields + field]: whether the field is a constant
+    std::vector<size_t> key_; // [sub * fields + field]: the hash of the constant
+    std::vector<node>   nodes_;
+    hash_fn             hash_[fields];
+    size_t              leaf_size_;
+    bool                built_ = false;
+
+    template <size_t N>
+    static auto hash_field(void)
+        -> typename std::enable_if<is_hashable<typename layout_t::template field_t<N>>::value, hash_fn>::type
+    {
+        return [](const T& tar)
+        {
+            using f_t = typename layout_t::template field_t<N>;
+            return std::hash<f_t>{}(layout_t::template get<N>(tar));
+        };
+    }
+
+    template <size_t N>
+    static auto hash_field(void)
+        -> typename std::enable_if<!is_hashable<typename layout_t::template field_t<N>>::value, hash_fn>::type
+    {
+        return nullptr;
+    }
+
+    template <size_t... I>
+    void init_hash(std::index_sequence<I...>)
+    {
+        hash_fn fs[] = { hash_field<I>()..., nullptr };
+        for (size_t i = 0; i < fields; ++i) hash_[i] = fs[i];
+    }
+
+    // The key of a constant field, converted to the type of the field before hashing.
+
+    template <size_t N, typename V>
+    static auto key_of(const value<V>& p, size_t& key)
+        -> typename std::enable_if<is_hashable<typename layout_t::template field_t<N>>::value && 
+                                   std::is_constructible<typename layout_t::template field_t<N>, const V&>::value, bool>::type
+    {
+        using f_t = typename layout_t::template field_t<N>;
+        key = std::hash<f_t>{}(f_t(p.t_));
+        return true;
+    }
+
+    template <size_t N, typename P>
+    static bool key_of(const P&, size_t&)
+    {
+        return false;
+    }
+
+    template <typename Tp, size_t... I>
+    void add_keys(const Tp& tp, std::index_sequence<I...>)
+    {
+        size_t base = has_.size();
+        has_.resize(base + fields, false);
+        key_.resize(base + fields, 0);
+        bool has[] = { key_of<I>(get<I>(tp), key_[base + I])..., false };
+        for (size_t i = 0; i < sizeof...(I); ++i) has_[base + i] = has[i] && (hash_[i] != nullptr);
+    }
+
+    std::uint32_t build(std::vector<std::uint32_t>&& subs, std::uint64_t used)
+    {
+        std::uint32_t id = static_cast<std::uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+
+        // Chooses the field with the fewest candidates expected: the wildcards plus
+        // the mean size of the bucket hit by an event.
+        size_t best = fields;
+        double best_cost = static_cast<double>(subs.size());
+        if (subs.size() > leaf_size_) for (size_t f = 0; f < fields; ++f)
+        {
+            if ((used >> f) & 1) continue;
+            std::unordered_map<size_t, size_t> buckets;
+            size_t wild = 0;
+            for (auto s : subs)
+            {
+                if (has_[s * fields + f]) ++buckets[key_[s * fields + f]];
+                else                      ++wild;
+            }
+            if (buckets.empty()) continue;
+            double cost = static_cast<double>(wild);
+            for (auto& b : buckets) cost += static_cast<double>(b.second) * b.second / subs.size();
+            if (cost < best_cost)
+            {
+                best = f;
+                best_cost = cost;
+            }
+        }
+        if (best == fields)
+        {
+            nodes_[id].subs_ = std::move(subs);
+            return id;
+        }
+
+        std::unordered_map<size_t, std::vector<std::uint32_t>> parts;
+        std::vector<std::uint32_t> wild;
+        for (auto s : subs)
+        {
+            if (has_[s * fields + best]) parts[key_[s * fields + best]].push_back(s);
+            else                         wild.push_back(s);
+        }
+        nodes_[id].field_ = best;
+        used |= std::uint64_t(1) << best;
+        for (auto& p : parts)
+        {
+            std::uint32_t kid = build(std::move(p.second), used);
+            nodes_[id].kids_.emplace(p.first, kid);
+        }
+        if (!wild.empty())
+        {
+            std::uint32_t kid = build(std::move(wild), used);
+            nodes_[id].wild_ = kid;
+        }
+        return id;
+    }
+
+    void collect(std::uint32_t id, const T& tar, std::vector<std::uint32_t>& out) const
+    {
+        for (;;)
+        {
+            const node& n = nodes_[id];
+            if (n.field_ == fields)
+            {
+                out.insert(out.end(), n.subs_.begin(), n.subs_.end());
+                return;
+            }
+            if (n.wild_ != npos) collect(n.wild_, tar, out);
+            auto it = n.kids_.find(hash_[n.field_](tar));
+            if (it == n.kids_.end()) return;
+            id = it->second;
+        }
+    }
+
+public:
+    static_assert(fields <= 64, "The discrimination net supports up to 64 fields.");
+
+    // A node with no more than leaf_size subscriptions isn't split.
+
+    explicit dnet(size_t leaf_size = 4)
+        : leaf_size_(leaf_size)
+    {
+        init_hash(std::make_index_sequence<fields>{});
+    }
+
+    size_t size(void) const { return tests_.size(); }
+
+    // Adds a subscription, which is the arguments of a C<T>(...), and returns its id.
+    // Should rebuild the net before matching after adding.
+
+    template <typename... A>
+    size_t add(A&&... args)
+    {
+        static_assert(sizeof...(A) <= fields, "Too many fields for the subscription.");
+        using pattern_t = constructor<T, decltype(keep(std::forward<A>(args)))...>;
+        pattern_t pat { keep(std::forward<A>(args))... };
+        add_keys(pat.parts(), std::index_sequence_for<A...>{});
+        tests_.emplace_back([pat](const T& tar) { return pat(tar); });
+        built_ = false;
+        return tests_.size() - 1;
+    }
+
+    void build(void)
+    {
+        nodes_.clear();
+        std::vector<std::uint32_t> all(tests_.size());
+        for (std::uint32_t i = 0; i < all.size(); ++i) all[i] = i;
+        build(std::move(all), 0);
+        built_ = true;
+    }
+
+    bool built(void) const { return built_; }
+
+    // Calls f(id) for each matched subscription, in the order of their ids.
+    // Returns the number of the candidates checked (all of them if the net hasn't been built).
+    // The candidates are gathered into "cands", which could be reused by the caller to save
+    // the allocations (f may match again, with another buffer).
+
+    template <typename F>
+    size_t match(const T& tar, F&& f) const
+    {
+        std::vector<std::uint32_t> cands;
+        return match(tar, std::forward<F>(f), cands);
+    }
+
+    template <typename F>
+    size_t match(const T& tar, F&& f, std::vector<std::uint32_t>& cands) const
+    {
+        if (!built_)
+        {
+            for (size_t s = 0; s < tests_.size(); ++s)
+            {
+                if (tests_[s](tar)) f(s);
+            }
+            return tests_.size();
+        }
+        cands.clear();
+        if (!nodes_.empty()) collect(0, tar, cands);
+        std::sort(cands.begin(), cands.end());
+        for (auto s : cands)
+        {
+            if (tests_[s](tar)) f(static_cast<size_t>(s));
+        }
+        return cands.size();
+    }
+
+    std::vector<size_t> match(const T& tar) const
+    {
+        std::vector<size_t> ids;
+        match(tar, [&ids](size_t id) { ids.push_back(id); });
+        return ids;
+    }
+};
+
+} // namespace match
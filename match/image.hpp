@@ -0,0 +1,314 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include "match/runtime.hpp"
+
+#include <vector>    // std::vector
+#include <string>    // std::string
+#include <stdexcept> // std::runtime_error
+#include <cstdint>   // std::uint32_t, std::uint64_t, ...
+#include <cstring>   // std::memcpy, std::memcmp
+#include <cstdio>    // std::FILE, std::fopen, ...
+
+#if defined(__unix__) || defined(__APPLE__)
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   define MATCH_IMAGE_MMAP_ 1
+#else
+#   define MATCH_IMAGE_MMAP_ 0
+#endif
+
+namespace match {
+namespace rt {
+
+/*
+ * The serialized images of the compiled programs.
+ *
+ * An image is a header followed by the arrays of a program_view, each one aligned to 8 bytes,
+ * in a fixed order. All the positions are computed from the counts in the header, so the image
+ * is position independent, and load_image could use it in place (e.g. from a mapped file)
+ * without parsing or allocating anything.
+ * The regexes are kept as their sources, and compiled by the matcher (there's no portable way
+ * to serialize a std::regex).
+ *
+ * The image is written in the native byte order, and is rejected on a machine with another one.
+*/
+
+enum : std::uint32_t
+{
+    image_version = 1,
+    image_endian  = 0x01020304
+};
+
+struct image_error : std::runtime_error
+{
+    using std::runtime_error::runtime_error;
+};
+
+struct image_header
+{
+    char          magic_[8]; // "MATCHRT"
+    std::uint32_t version_;
+    std::uint32_t endian_;
+    std::uint64_t size_;     // of the whole image
+    std::uint64_t checksum_; // of the bytes after the header
+    std::uint32_t code_, count_, ints_, reals_, strs_, chars_;
+};
+
+namespace detail_image {
+
+inline size_t align8(size_t n) { return (n + 7) & ~size_t(7); }
+
+// The offsets of the sections, in the order of writing.
+
+struct sections
+{
+    size_t ints_, reals_, args_, extra_, rules_, strs_, ops_, chars_, end_;
+
+    explicit sections(const image_header& h)
+    {
+        size_t p = align8(sizeof(image_header));
+        ints_  = p; p = align8(p + sizeof(std::int64_t)  * h.ints_);
+        reals_ = p; p = align8(p + sizeof(double)        * h.reals_);
+        args_  = p; p = align8(p + sizeof(std::uint32_t) * h.code_);
+        extra_ = p; p = align8(p + sizeof(std::uint32_t) * h.code_);
+        rules_ = p; p = align8(p + sizeof(std::uint32_t) * (h.count_ + 1));
+        strs_  = p; p = align8(p + sizeof(str_ref)       * h.strs_);
+        ops_   = p; p = align8(p + h.code_);
+        chars_ = p; p = align8(p + h.chars_);
+        end_   = p;
+    }
+};
+
+// FNV-1a over the 8-byte words (the sections are padded to 8 bytes).
+
+inline std::uint64_t checksum(const char* p, size_t n)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; i += 8)
+    {
+        std::uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+template <typename T>
+void put(std::vector<char>& buf, size_t off, const T* src, size_t n)
+{
+    if (n != 0) std::memcpy(buf.data() + off, src, sizeof(T) * n);
+}
+
+} // namespace detail_image
+
+/*
+ * Writes a program into an image.
+*/
+
+inline std::vector<char> save_image(const program_view& p)
+{
+    image_header h {};
+    std::memcpy(h.magic_, "MATCHRT", 8);
+    h.version_ = image_version;
+    h.endian_  = image_endian;
+    h.code_    = static_cast<std::uint32_t>(p.code_);
+    h.count_   = static_cast<std::uint32_t>(p.count_);
+    h.strs_    = static_cast<std::uint32_t>(p.nstrs_);
+
+    // The pools have no count in the view, so they are measured by their uses.
+    for (size_t pc = 0; pc < p.code_; ++pc)
+    {
+        std::uint32_t a = p.args_[pc];
+        switch (static_cast<op>(p.ops_[pc]))
+        {
+        case op::int_eq:     if (a + 1 > h.ints_ ) h.ints_  = a + 1; break;
+        case op::int_range:  if (a + 2 > h.ints_ ) h.ints_  = a + 2; break;
+        case op::real_eq:    if (a + 1 > h.reals_) h.reals_ = a + 1; break;
+        case op::real_range: if (a + 2 > h.reals_) h.reals_ = a + 2; break;
+        default: break;
+        }
+    }
+    for (size_t i = 0; i < p.nstrs_; ++i)
+    {
+        std::uint32_t e = p.strs_[i].off_ + p.strs_[i].len_;
+        if (e > h.chars_) h.chars_ = e;
+    }
+
+    detail_image::sections s(h);
+    h.size_ = s.end_;
+    std::vector<char> buf(s.end_, 0);
+    detail_image::put(buf, s.ints_ , p.ints_ , h.ints_);
+    detail_image::put(buf, s.reals_, p.reals_, h.reals_);
+    detail_image::put(buf, s.args_ , p.args_ , h.code_);
+    detail_image::put(buf, s.extra_, p.extra_, h.code_);
+    detail_image::put(buf, s.rules_, p.rules_, (h.count_ == 0) ? 0 : h.count_ + 1);
+    detail_image::put(buf, s.strs_ , p.strs_ , h.strs_);
+    detail_image::put(buf, s.ops_  , p.ops_  , h.code_);
+    detail_image::put(buf, s.chars_, p.chars_, h.chars_);
+    size_t b = detail_image::align8(sizeof(image_header));
+    h.checksum_ = detail_image::checksum(buf.data() + b, s.end_ - b);
+    std::memcpy(buf.data(), &h, sizeof(h));
+    return buf;
+}
+
+inline std::vector<char> save_image(const program& p)
+{
+    return save_image(p.view());
+}
+
+/*
+ * Checks an image, and returns a view on it (the image should be kept while the view is used).
+ * Everything the matcher relies on is validated: the header, the checksum, the indices into the
+ * pools, and the depth of the stack of each rule. It throws an image_error if anything is wrong.
+*/
+
+inline program_view load_image(const void* data, size_t size)
+{
+    auto base = static_cast<const char*>(data);
+    if ((reinterpret_cast<std::uintptr_t>(base) & 7) != 0) throw image_error("The image is not aligned to 8 bytes.");
+    if (size < sizeof(image_header))                        throw image_error("The image is truncated.");
+    image_header h;
+    std::memcpy(&h, base, sizeof(h));
+    if (std::memcmp(h.magic_, "MATCHRT", 8) != 0) throw image_error("It's not a pattern image.");
+    if (h.version_ != image_version)              throw image_error("Unsupported image version " + std::to_string(h.version_) + ".");
+    if (h.endian_ != image_endian)                throw image_error("The image has another byte order.");
+
+    detail_image::sections s(h);
+    if ((h.size_ != s.end_) || (size < s.end_)) throw image_error("The image is truncated, or its size is wrong.");
+    size_t b = detail_image::align8(sizeof(image_header));
+    if (detail_image::checksum(base + b, s.end_ - b) != h.checksum_) throw image_error("The image is corrupted (bad checksum).");
+
+    program_view p;
+    p.ops_   = reinterpret_cast<const std::uint8_t *>(base + s.ops_);
+    p.args_  = reinterpret_cast<const std::uint32_t*>(base + s.args_);
+    p.extra_ = reinterpret_cast<const std::uint32_t*>(base + s.extra_);
+    p.code_  = h.code_;
+    p.rules_ = reinterpret_cast<const std::uint32_t*>(base + s.rules_);
+    p.count_ = h.count_;
+    p.ints_  = reinterpret_cast<const std::int64_t *>(base + s.ints_);
+    p.reals_ = reinterpret_cast<const double       *>(base + s.reals_);
+    p.strs_  = reinterpret_cast<const str_ref      *>(base + s.strs_);
+    p.nstrs_ = h.strs_;
+    p.chars_ = base + s.chars_;
+
+    // A checksum only catches the accidents, so the contents are validated as well.
+    for (size_t i = 0; i < p.nstrs_; ++i)
+    {
+        if (std::uint64_t(p.strs_[i].off_) + p.strs_[i].len_ > h.chars_) throw image_error("A string is out of range.");
+    }
+    if ((p.count_ != 0) && (p.rules_[0] != 0)) throw image_error("The first rule doesn't start at 0.");
+    if ((p.count_ != 0) ? (p.rules_[p.count_] != p.code_) : (p.code_ != 0)) throw image_error("The rules don't cover the code.");
+    for (size_t i = 0; i < p.count_; ++i)
+    {
+        if (p.rules_[i] > p.rules_[i + 1]) throw image_error("The rules are out of order.");
+        size_t sp = 1;
+        for (size_t pc = p.rules_[i]; pc < p.rules_[i + 1]; ++pc)
+        {
+            std::uint32_t a = p.args_[pc];
+            if (sp == 0) throw image_error("The stack of a rule underflows.");
+            --sp;
+            switch (static_cast<op>(p.ops_[pc]))
+            {
+            case op::any:
+            case op::null:
+                break;
+            case op::int_eq:     if (a >= h.ints_ ) throw image_error("An integer is out of range."); break;
+            case op::int_range:  if (std::uint64_t(a) + 2 > h.ints_ ) throw image_error("An integer is out of range."); break;
+            case op::real_eq:    if (a >= h.reals_) throw image_error("A real is out of range."); break;
+            case op::real_range: if (std::uint64_t(a) + 2 > h.reals_) throw image_error("A real is out of range."); break;
+            case op::str_eq:
+            case op::regex:      if (a >= h.strs_ ) throw image_error("A string is out of range."); break;
+            case op::record:
+                if (p.extra_[pc] >= h.strs_) throw image_error("A type name is out of range.");
+                // fall through
+            case op::sequence:
+                if (a > max_depth - sp) throw image_error("A rule is too deep.");
+                sp += a;
+                break;
+            default:
+                throw image_error("Unknown instruction " + std::to_string(p.ops_[pc]) + ".");
+            }
+        }
+    }
+    return p;
+}
+
+/*
+ * A read-only image file, which is mapped into the memory when it's possible,
+ * or read into a buffer otherwise.
+*/
+
+class image_file
+{
+    const void*       data_ = nullptr;
+    size_t            size_ = 0;
+    std::vector<char> buf_;
+
+public:
+    explicit image_file(const char* path)
+    {
+#if MATCH_IMAGE_MMAP_
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) throw image_error(std::string("Cannot open ") + path + ".");
+        struct stat st;
+        if ((::fstat(fd, &st) != 0) || (st.st_size < 0))
+        {
+            ::close(fd);
+            throw image_error(std::string("Cannot stat ") + path + ".");
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ != 0)
+        {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED) throw image_error(std::string("Cannot map ") + path + ".");
+            data_ = p;
+        }
+        else ::close(fd);
+#else
+        std::FILE* f = std::fopen(path, "rb");
+        if (f == nullptr) throw image_error(std::string("Cannot open ") + path + ".");
+        char tmp[4096];
+        size_t n;
+        while ((n = std::fread(tmp, 1, sizeof(tmp), f)) > 0) buf_.insert(buf_.end(), tmp, tmp + n);
+        std::fclose(f);
+        data_ = buf_.data();
+        size_ = buf_.size();
+#endif
+    }
+
+    ~image_file(void)
+    {
+#if MATCH_IMAGE_MMAP_
+        if (data_ != nullptr) ::munmap(const_cast<void*>(data_), size_);
+#endif
+    }
+
+    image_file(const image_file&) = delete;
+    image_file& operator=(const image_file&) = delete;
+
+    const void* data(void) const { return data_; }
+    size_t      size(void) const { return size_; }
+
+    program_view view(void) const { return load_image(data_, size_); }
+};
+
+inline void write_image(const char* path, const std::vector<char>& image)
+{
+    std::FILE* f = std::fopen(path, "wb");
+    if (f == nullptr) throw image_error(std::string("Cannot create ") + path + ".");
+    bool ok = (std::fwrite(image.data(), 1, image.size(), f) == image.size());
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok) throw image_error(std::string("Cannot write ") + path + ".");
+}
+
+} // namespace rt
+} // namespace match
@@ -0,0 +1,146 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include <cstdint> // std::uint32_t
+#include <cstdio>  // std::FILE, std::fprintf
+
+/*
+ * The USDT (systemtap sdt.h) probes of the match sites, for profiling the inlined matches in production.
+ * Build with MATCH_PROBES=1 to place them (match.hpp includes this file then), otherwise they're
+ * compiled away entirely.
+ *
+ * Each statement match (Match, HotMatch, MemoMatch, TypeMatch) fires:
+ *  match:enter (site, line), when it's entered, and
+ *  match:arm   (site, line), when an arm (or Otherwise) is taken, with the line of the arm.
+ * The site is the FNV-1a hash of the "file:line" of the match. A probe is a single nop until
+ * a tracer attaches to it, e.g.:
+ *  bpftrace -e 'usdt:./app:match:arm { @[arg0, arg1] = count(); }'
+ *  perf probe -x ./app sdt_match:arm && perf record -e sdt_match:arm ./app
+ *
+ * The sites are also listed in the section "match_sites" of the binary (see probe_sites()), so
+ * the hashes could be turned into the names by write_sites(), or read from the binary by a tool.
+*/
+
+namespace match {
+
+constexpr std::uint32_t fnv1a(const char* s, std::uint32_t h = 2166136261u)
+{
+    while (*s != '\0') h = (h ^ static_cast<unsigned char>(*s++)) * 16777619u;
+    return h;
+}
+
+constexpr std::uint32_t site_id(const char* file, unsigned line)
+{
+    char digits[12] = { ':' };
+    size_t n = 1;
+    for (unsigned l = line; (l != 0) || (n == 1); l /= 10) ++n;
+    for (size_t i = n - 1; i > 0; --i, line /= 10) digits[i] = static_cast<char>('0' + line % 10);
+    return fnv1a(digits, fnv1a(file));
+}
+
+struct probe_site
+{
+    std::uint32_t id_;
+    unsigned      line_;
+    const char*   file_;
+};
+
+} // namespace match
+
+#if defined(__GNUC__) && defined(__ELF__)
+
+// The section is bounded by the symbols the linker defines for it (they are null without any site).
+
+extern "C" __attribute__((weak)) const match::probe_site __start_match_sites[];
+extern "C" __attribute__((weak)) const match::probe_site __stop_match_sites [];
+
+#define MATCH_PROBE_RECORD_(ID) \
+    __attribute__((used, section("match_sites"))) static const match::probe_site match_probe_site_ = { ID, __LINE__, __FILE__ };
+
+#else
+#define MATCH_PROBE_RECORD_(ID)
+#endif
+
+#if defined(__has_include)
+#   if __has_include(<sys/sdt.h>)
+#       include <sys/sdt.h>
+#       define MATCH_PROBE_(NAME, A1, A2) DTRACE_PROBE2(match, NAME, A1, A2)
+#   endif
+#endif
+
+// Without <sys/sdt.h>, the same note (see the systemtap SDT format) is written for x86-64.
+
+#if !defined(MATCH_PROBE_) && defined(__GNUC__) && defined(__ELF__) && defined(__x86_64__)
+#define MATCH_PROBE_(NAME, A1, A2)                                                          \
+    __asm__ __volatile__ (                                                                  \
+        "990: nop\n"                                                                        \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                                       \
+        ".balign 4\n"                                                                       \
+        ".4byte 992f-991f,994f-993f,3\n"                                                    \
+        "991: .asciz \"stapsdt\"\n"                                                         \
+        "992: .balign 4\n"                                                                  \
+        "993: .8byte 990b\n"                                                                \
+        ".8byte _.stapsdt.base\n"                                                           \
+        ".8byte 0\n"                                                                        \
+        ".asciz \"match\"\n"                                                                \
+        ".asciz \"" #NAME "\"\n"                                                            \
+        ".asciz \"4@%0 4@%1\"\n"                                                            \
+        "994: .balign 4\n"                                                                  \
+        ".popsection\n"                                                                     \
+        ".ifndef _.stapsdt.base\n"                                                          \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"            \
+        ".weak _.stapsdt.base\n"                                                            \
+        ".hidden _.stapsdt.base\n"                                                          \
+        "_.stapsdt.base: .space 1\n"                                                        \
+        ".size _.stapsdt.base,1\n"                                                          \
+        ".popsection\n"                                                                     \
+        ".endif\n"                                                                          \
+        :: "nr"(static_cast<std::uint32_t>(A1)), "nr"(static_cast<std::uint32_t>(A2)))
+#endif
+
+#if !defined(MATCH_PROBE_)
+#define MATCH_PROBE_(NAME, A1, A2) ((void)0) // no probe on this platform
+#endif
+
+#define MATCH_PROBE_SITE_()                                                                 \
+    enum : std::uint32_t { match_probe_id_ = match::site_id(__FILE__, __LINE__) };          \
+    MATCH_PROBE_RECORD_(match_probe_id_)                                                    \
+    MATCH_PROBE_(enter, match_probe_id_, __LINE__);
+
+#define MATCH_PROBE_ARM_() MATCH_PROBE_(arm, match_probe_id_, __LINE__);
+
+namespace match {
+
+struct probe_sites_t
+{
+    const probe_site* begin_;
+    const probe_site* end_;
+
+    const probe_site* begin(void) const { return begin_; }
+    const probe_site* end  (void) const { return end_;   }
+};
+
+inline probe_sites_t probe_sites(void)
+{
+#if defined(__GNUC__) && defined(__ELF__)
+    return { __start_match_sites, __stop_match_sites };
+#else
+    return { nullptr, nullptr };
+#endif
+}
+
+// Writes the table of the sites, one "0x<site> <file>:<line>" a line.
+
+inline void write_sites(std::FILE* out)
+{
+    for (auto& s : probe_sites())
+    {
+        std::fprintf(out, "0x%08x %s:%u\n", static_cast<unsigned>(s.id_), s.file_, s.line_);
+    }
+}
+
+} // namespace match
@@ -0,0 +1,47 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include "match.hpp"
+
+#include <regex> // std::regex, std::regex_match
+
+namespace match {
+
+/*
+ * Regular expression pattern: Regex("\\w+@\\w+")
+ *
+ * It's kept out of match.hpp, since <regex> is one of the most expensive headers to compile.
+*/
+
+struct regex
+{
+    std::regex r_;
+
+    template <typename T>
+    regex(T&& r)
+        : r_(std::forward<T>(r))
+    {}
+
+    template <typename U>
+    bool operator()(U&& tar) const
+    {
+        return std::regex_match(std::forward<U>(tar), r_);
+    }
+};
+
+template <>
+struct is_pattern<regex> : std::true_type{};
+
+template <>
+struct is_memoized<regex> : std::true_type {};
+
+template <>
+struct pattern_cost<regex> : std::integral_constant<size_t, cost_regex> {};
+
+} // namespace match
+
+#define Regex(...) match::regex { __VA_ARGS__ }
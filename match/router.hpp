@@ -0,0 +1,312 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include "match.hpp"
+
+#include <vector>     // std::vector
+#include <memory>     // std::unique_ptr
+#include <functional> // std::function
+#include <atomic>     // std::atomic
+#include <thread>     // std::thread, std::this_thread::yield, std::this_thread::sleep_for
+#include <chrono>     // std::chrono::microseconds
+#include <new>        // placement new
+#include <cstdint>    // std::intptr_t
+
+namespace match {
+
+/*
+ * A bounded lock-free queue, for many producers and a single consumer.
+ *
+ * Each slot has a sequence number, telling whether it's free for the push at a position, or
+ * filled for the pop at that position (D. Vyukov's bounded queue). The producers only contend
+ * on the tail, and the consumer owns the head, so the positions double as the counters of the
+ * pushed and popped elements.
+*/
+
+enum : size_t { cache_line = 64 };
+
+template <typename T>
+class mpsc_ring
+{
+    struct slot
+    {
+        std::atomic<size_t> seq_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type buf_;
+    };
+
+    std::unique_ptr<slot[]> slots_;
+    size_t                  mask_;
+
+    // Padded rather than aligned, since the over-aligned types can't be allocated with new before C++17.
+    char                pad0_[cache_line];
+    std::atomic<size_t> tail_ { 0 }; // for the producers
+    char                pad1_[cache_line - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> head_ { 0 }; // for the consumer
+    char                pad2_[cache_line - sizeof(std::atomic<size_t>)];
+
+    T& at(slot& s) { return *reinterpret_cast<T*>(&s.buf_); }
+
+public:
+    // The capacity is rounded up to a power of 2.
+
+    explicit mpsc_ring(size_t capacity)
+    {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        slots_.reset(new slot[n]);
+        mask_ = n - 1;
+        for (size_t i = 0; i < n; ++i) slots_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+
+    ~mpsc_ring(void)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;; ++pos)
+        {
+            slot& s = slots_[pos & mask_];
+            if (s.seq_.load(std::memory_order_acquire) != pos + 1) break;
+            at(s).~T();
+        }
+    }
+
+    mpsc_ring(const mpsc_ring&) = delete;
+    mpsc_ring& operator=(const mpsc_ring&) = delete;
+
+    size_t capacity(void) const { return mask_ + 1; }
+
+    // Returns false if the queue is full.
+
+    template <typename U>
+    bool push(U&& v)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            slot& s = slots_[pos & mask_];
+            auto dif = static_cast<std::intptr_t>(s.seq_.load(std::memory_order_acquire) - pos);
+            if (dif == 0)
+            {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    ::new (&s.buf_) T(std::forward<U>(v));
+                    s.seq_.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (dif < 0) return false;
+            else pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Pops up to n elements, and calls f(T&) on each one. Only for the consumer.
+    // An element is moved out of its slot before f is called, so the slot is freed even if f throws.
+
+    template <typename F>
+    size_t pop(size_t n, F&& f)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed), i = 0;
+        for (; i < n; ++i, ++pos)
+        {
+            slot& s = slots_[pos & mask_];
+            if (s.seq_.load(std::memory_order_acquire) != pos + 1) break;
+            T v(std::move(at(s)));
+            at(s).~T();
+            s.seq_.store(pos + mask_ + 1, std::memory_order_release);
+            head_.store(pos + 1, std::memory_order_release);
+            f(v);
+        }
+        return i;
+    }
+
+    size_t pushed(void) const { return tail_.load(std::memory_order_acquire); }
+    size_t popped(void) const { return head_.load(std::memory_order_acquire); }
+
+    size_t depth(void) const
+    {
+        size_t h = popped(), t = pushed();
+        return (t > h) ? t - h : 0;
+    }
+};
+
+/*
+ * A pattern-based message router.
+ *
+ * The handlers are registered with a pattern each (e.g. Type(...), C<T>(...), Range(...)), which
+ * is tested against the message, or against the object it points to for a (smart) pointer message.
+ * A message published goes to the first handler matching it, just like a Case in a Match, and is
+ * pushed into the lock-free queue of that handler. The queues are drained in batches, either by
+ * the worker threads (each handler belongs to one worker, so a handler is never run concurrently
+ * with itself) or by poll() on the calling thread.
+ *
+ * The handlers should be registered before publishing, and before starting the workers.
+*/
+
+// Tests a pattern against the message, or against the object a (smart) pointer message points to.
+// A null pointer message matches no handler, so it's counted as unrouted.
+
+template <typename P, typename T>
+inline auto route_test(const P& pat, const T& msg, int) -> decltype(static_cast<bool>(msg), pat(*msg), bool())
+{
+    return static_cast<bool>(msg) && pat(*msg);
+}
+
+template <typename P, typename T>
+inline bool route_test(const P& pat, const T& msg, long)
+{
+    return pat(msg);
+}
+
+template <typename M>
+class router
+{
+    struct handler
+    {
+        std::function<bool(const M&)> test_;
+        std::function<void(M&)>       run_;
+        mpsc_ring<M>                  queue_;
+        std::atomic<size_t>           rejected_ { 0 };
+
+        template <typename P, typename F>
+        handler(P&& pat, F&& f, size_t capacity)
+            : test_([pat](const M& msg) { return route_test(pat, msg, 0); })
+            , run_(std::forward<F>(f))
+            , queue_(capacity)
+        {}
+    };
+
+    std::vector<std::unique_ptr<handler>> handlers_;
+    std::atomic<size_t>                   unrouted_ { 0 };
+    std::vector<std::thread>              workers_;
+    std::atomic<bool>                     running_ { false };
+    size_t                                capacity_; // of the queue of each handler
+    size_t                                batch_;    // the most messages taken from a queue at a time
+
+    // An idle worker yields for a while, then sleeps longer and longer (up to about 1ms),
+    // so that it doesn't keep a core busy while the queues stay empty.
+
+    static void backoff(size_t idle)
+    {
+        enum : size_t { spins = 64, max_shift = 10 };
+        if (idle <= spins) std::this_thread::yield();
+        else
+        {
+            size_t shift = (idle - spins < max_shift) ? idle - spins : max_shift;
+            std::this_thread::sleep_for(std::chrono::microseconds(size_t(1) << shift));
+        }
+    }
+
+    size_t drain(size_t first, size_t step, size_t n)
+    {
+        size_t done = 0;
+        for (size_t i = first; i < handlers_.size(); i += step)
+        {
+            auto& h = *handlers_[i];
+            done += h.queue_.pop(n, h.run_);
+        }
+        return done;
+    }
+
+public:
+    struct stats
+    {
+        size_t published_; // pushed into the queue
+        size_t handled_;   // taken from the queue by the handler
+        size_t rejected_;  // dropped, because the queue was full
+        size_t depth_;     // in the queue now
+    };
+
+    // The capacity of the queue of each handler, and the most messages taken from a queue at a time.
+
+    explicit router(size_t capacity = 4096, size_t batch = 64)
+        : capacity_(capacity), batch_(batch)
+    {}
+
+    router(const router&) = delete;
+    router& operator=(const router&) = delete;
+
+    ~router(void) { stop(); }
+
+    size_t size(void) const { return handlers_.size(); }
+
+    // Registers a handler f(M&) for the messages matched by the pattern, and returns its id.
+
+    template <typename P, typename F>
+    size_t on(P&& pattern, F&& f)
+    {
+        handlers_.emplace_back(new handler(keep(std::forward<P>(pattern)), std::forward<F>(f), capacity_));
+        return handlers_.size() - 1;
+    }
+
+    // Returns false if no handler matches the message, or if the queue of the handler is full.
+    // The message is converted to M once, so that a test never moves it out (e.g. from a unique_ptr<Derived>).
+
+    template <typename U>
+    bool publish(U&& msg)
+    {
+        M m(std::forward<U>(msg));
+        for (auto& h : handlers_)
+        {
+            if (!h->test_(m)) continue;
+            if (h->queue_.push(std::move(m))) return true;
+            h->rejected_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        unrouted_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Runs the handlers on the messages queued, on the calling thread, and returns the number of them.
+    // Should not be called while the workers are running.
+
+    size_t poll(void)
+    {
+        size_t done = 0, n;
+        while ((n = drain(0, 1, batch_)) != 0) done += n;
+        return done;
+    }
+
+    // Starts the workers, handler i is run by the worker (i % threads).
+
+    void start(size_t threads)
+    {
+        stop();
+        if (threads == 0) threads = 1;
+        running_.store(true, std::memory_order_release);
+        for (size_t w = 0; w < threads; ++w)
+        {
+            workers_.emplace_back([this, w, threads]
+            {
+                size_t idle = 0;
+                while (running_.load(std::memory_order_acquire))
+                {
+                    if (drain(w, threads, batch_) != 0) idle = 0;
+                    else backoff(++idle);
+                }
+                while (drain(w, threads, batch_) != 0) ;
+            });
+        }
+    }
+
+    // Stops the workers, after they have drained their queues.
+
+    void stop(void)
+    {
+        running_.store(false, std::memory_order_release);
+        for (auto& t : workers_) t.join();
+        workers_.clear();
+    }
+
+    stats stat(size_t id) const
+    {
+        auto& h = *handlers_[id];
+        return { h.queue_.pushed(), h.queue_.popped(), h.rejected_.load(std::memory_order_relaxed), h.queue_.depth() };
+    }
+
+    size_t unrouted(void) const { return unrouted_.load(std::memory_order_relaxed); }
+};
+
+} // namespace match
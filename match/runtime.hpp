@@ -0,0 +1,775 @@
+/*
+    cpp-pattern-matching - Code covered by the MIT License
+    Author: mutouyun (http://orzz.org)
+*/
+
+#pragma once
+
+#include "match.hpp"
+
+#include <vector>    // std::vector
+#include <string>    // std::string
+#include <unordered_map> // std::unordered_map
+#include <regex>     // std::regex
+#include <memory>    // std::unique_ptr
+#include <stdexcept> // std::runtime_error, std::invalid_argument, std::length_error
+#include <cstdint>   // std::int64_t, std::uint32_t, ...
+#include <cstdlib>   // std::strtoll, std::strtod
+#include <cctype>    // std::isalnum
+#include <iterator>  // std::begin, std::end
+
+namespace match {
+namespace rt {
+
+/*
+ * Runtime patterns, for the rules which are loaded (e.g. from a config file) instead of compiled.
+ *
+ * A rule is a tree of "pattern" nodes: constant, wildcard, null, range, regex, registered-type
+ * constructor and sequence. The rules are compiled into a flat bytecode program kept in arrays
+ * (structure of arrays), and run by the "matcher" on the views of the C++ objects.
+ * The fields of the constructor patterns are read through the MATCH_REGIST_TYPE layouts.
+*/
+
+/*
+ * The type descriptors & value views
+*/
+
+enum class kind : std::uint8_t
+{
+    other,   // can only be matched by the wildcard
+    integer,
+    real,
+    string,
+    pointer,
+    record,  // a registered type
+    sequence
+};
+
+struct descriptor;
+
+struct value
+{
+    const descriptor* desc_;
+    const void*       ptr_;
+};
+
+struct descriptor
+{
+    kind              kind_;
+    std::uint8_t      size_;    // for integer & real
+    bool              signed_;  // for integer
+    size_t            fields_;  // for record
+    const descriptor* (*target_)(void); // for pointer, gets the descriptor of the pointee lazily
+    const value*      field_;   // for record, the descriptors & offsets of the fields
+    void            (*str_)(const void*, const char*&, size_t&);      // for string
+    size_t          (*elements_)(const void*, size_t, value*);        // for sequence, gets the first n elements
+};
+
+template <typename T, typename = void> struct describer;
+
+template <typename T>
+inline const descriptor* describe(void)
+{
+    static const descriptor d = describer<underlying<T>>::make();
+    return &d;
+}
+
+template <typename T, typename>
+struct describer
+{
+    static descriptor make(void) { return { kind::other, 0, false, 0, nullptr, nullptr, nullptr, nullptr }; }
+};
+
+// An enum is as signed as its underlying type.
+
+template <typename T, bool = std::is_enum<T>::value>
+struct is_signed_integer : std::is_signed<T> {};
+
+template <typename T>
+struct is_signed_integer<T, true> : std::is_signed<typename std::underlying_type<T>::type> {};
+
+template <typename T>
+struct describer<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+{
+    static descriptor make(void)
+    {
+        return { kind::integer, sizeof(T), is_signed_integer<T>::value, 0, nullptr, nullptr, nullptr, nullptr };
+    }
+};
+
+template <typename T>
+struct describer<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static descriptor make(void) { return { kind::real, sizeof(T), true, 0, nullptr, nullptr, nullptr, nullptr }; }
+};
+
+template <>
+struct describer<std::string>
+{
+    static void str(const void* p, const char*& s, size_t& n)
+    {
+        auto& x = *static_cast<const std::string*>(p);
+        s = x.data();
+        n = x.size();
+    }
+    static descriptor make(void) { return { kind::string, 0, false, 0, nullptr, nullptr, &str, nullptr }; }
+};
+
+template <>
+struct describer<const char*>
+{
+    static void str(const void* p, const char*& s, size_t& n)
+    {
+        s = *static_cast<const char* const*>(p);
+        n = s ? std::strlen(s) : 0;
+    }
+    static descriptor make(void) { return { kind::string, 0, false, 0, nullptr, nullptr, &str, nullptr }; }
+};
+
+template <typename T>
+struct describer<T*, typename std::enable_if<!std::is_same<underlying<T>, char>::value>::type>
+{
+    static descriptor make(void) { return { kind::pointer, 0, false, 0, &describe<T>, nullptr, nullptr, nullptr }; }
+};
+
+// Only the types registered by MATCH_REGIST_* are records. The ones taken apart without a registration
+// (the tuple-likes & aggregates) aren't, so that e.g. a std::array is still described as a sequence.
+
+template <typename L>
+struct is_auto_layout : std::false_type {};
+template <typename T>
+struct is_auto_layout<tuple_layout<T>> : std::true_type {};
+#if __cplusplus >= 201703L
+template <typename T>
+struct is_auto_layout<aggregate_layout<T>> : std::true_type {};
+#endif
+
+template <typename T>
+struct is_registered_
+{
+    template <typename U> static auto check(typename bindings<U>::layout_t*)
+        -> std::integral_constant<bool, !is_auto_layout<typename bindings<U>::layout_t>::value>;
+    template <typename U> static std::false_type check(...);
+};
+template <typename T>
+using is_registered = decltype(is_registered_<T>::template check<T>(nullptr));
+
+template <typename T>
+struct describer<T, typename std::enable_if<is_registered<T>::value && !std::is_pointer<T>::value>::type>
+{
+    using layout_t = typename bindings<T>::layout_t;
+
+    // The offset of a field, which is computed on an unused storage (no field is read).
+
+    template <size_t N>
+    static value field(void)
+    {
+        static const typename std::aligned_storage<sizeof(T), alignof(T)>::type buf {};
+        auto& x = reinterpret_cast<const T&>(buf);
+        auto off = reinterpret_cast<const char*>(std::addressof(layout_t::template get<N>(x))) - 
+                   reinterpret_cast<const char*>(std::addressof(x));
+        return { describe<typename layout_t::template field_t<N>>(), reinterpret_cast<const void*>(off) };
+    }
+
+    template <size_t... I>
+    static const value* fields(std::index_sequence<I...>)
+    {
+        static const value fs[] = { field<I>()..., value{ nullptr, nullptr } };
+        return fs;
+    }
+
+    static descriptor make(void)
+    {
+        return { kind::record, 0, false, layout_t::size, nullptr, 
+                 fields(std::make_index_sequence<layout_t::size>{}), nullptr, nullptr };
+    }
+};
+
+template <typename T>
+struct describer<T, typename std::enable_if<!is_registered<T>::value && !std::is_same<T, std::string>::value &&
+                                            std::is_lvalue_reference<decltype(*std::begin(std::declval<const T&>()))>::value>::type>
+{
+    static size_t elements(const void* p, size_t n, value* out)
+    {
+        auto& c = *static_cast<const T*>(p);
+        size_t i = 0;
+        for (auto it = std::begin(c); (i < n) && (it != std::end(c)); ++it, ++i)
+        {
+            out[i] = { describe<decltype(*it)>(), std::addressof(*it) };
+        }
+        return i;
+    }
+    static descriptor make(void) { return { kind::sequence, 0, false, 0, nullptr, nullptr, nullptr, &elements }; }
+};
+
+template <typename T>
+inline value view(const T& x)
+{
+    return { describe<T>(), std::addressof(x) };
+}
+
+inline bool load_int(const value& v, std::int64_t& r)
+{
+    const descriptor* d = v.desc_;
+    if (d->kind_ != kind::integer) return false;
+    switch (d->size_)
+    {
+    case 1: r = d->signed_ ? std::int64_t(*static_cast<const std::int8_t *>(v.ptr_)) : std::int64_t(*static_cast<const std::uint8_t *>(v.ptr_)); break;
+    case 2: r = d->signed_ ? std::int64_t(*static_cast<const std::int16_t*>(v.ptr_)) : std::int64_t(*static_cast<const std::uint16_t*>(v.ptr_)); break;
+    case 4: r = d->signed_ ? std::int64_t(*static_cast<const std::int32_t*>(v.ptr_)) : std::int64_t(*static_cast<const std::uint32_t*>(v.ptr_)); break;
+    default: r = *static_cast<const std::int64_t*>(v.ptr_); break;
+    }
+    return true;
+}
+
+inline bool load_real(const value& v, double& r)
+{
+    const descriptor* d = v.desc_;
+    if (d->kind_ == kind::real)
+    {
+        if      (d->size_ == sizeof(float))  r = *static_cast<const float*>(v.ptr_);
+        else if (d->size_ == sizeof(double)) r = *static_cast<const double*>(v.ptr_);
+        else                                 r = static_cast<double>(*static_cast<const long double*>(v.ptr_));
+        return true;
+    }
+    std::int64_t i;
+    if (!load_int(v, i)) return false;
+    r = static_cast<double>(i);
+    return true;
+}
+
+/*
+ * The registry of the record types, by their names in the rules
+*/
+
+class registry
+{
+    std::vector<std::pair<std::string, const descriptor*>> types_;
+
+public:
+    template <typename T>
+    registry& add(std::string name)
+    {
+        static_assert(is_registered<T>::value, "The type should be registered by MATCH_REGIST_TYPE first.");
+        types_.emplace_back(std::move(name), describe<T>());
+        return *this;
+    }
+
+    const descriptor* find(const char* name, size_t len) const
+    {
+        for (auto& t : types_)
+        {
+            if ((t.first.size() == len) && (t.first.compare(0, len, name, len) == 0)) return t.second;
+        }
+        return nullptr;
+    }
+};
+
+/*
+ * The pattern AST
+*/
+
+enum class op : std::uint8_t
+{
+    any, null, int_eq, real_eq, str_eq, int_range, real_range, regex, record, sequence
+};
+
+struct pattern
+{
+    op                   op_ = op::any;
+    std::int64_t         i_[2] = {};
+    double               r_[2] = {};
+    std::string          s_;       // string constant, regex or type name
+    std::vector<pattern> kids_;
+
+    static pattern any (void)                          { return {}; }
+    static pattern null(void)                          { pattern p; p.op_ = op::null; return p; }
+    static pattern integer(std::int64_t v)             { pattern p; p.op_ = op::int_eq; p.i_[0] = v; return p; }
+    static pattern real(double v)                      { pattern p; p.op_ = op::real_eq; p.r_[0] = v; return p; }
+    static pattern string(std::string v)               { pattern p; p.op_ = op::str_eq; p.s_ = std::move(v); return p; }
+    static pattern range(std::int64_t lo, std::int64_t hi) 
+                                                       { pattern p; p.op_ = op::int_range; p.i_[0] = lo; p.i_[1] = hi; return p; }
+    static pattern range(double lo, double hi)         { pattern p; p.op_ = op::real_range; p.r_[0] = lo; p.r_[1] = hi; return p; }
+    static pattern regex(std::string re)               { pattern p; p.op_ = op::regex; p.s_ = std::move(re); return p; }
+    static pattern record(std::string type, std::vector<pattern> kids)
+                                                       { pattern p; p.op_ = op::record; p.s_ = std::move(type); p.kids_ = std::move(kids); return p; }
+    static pattern sequence(std::vector<pattern> kids) { pattern p; p.op_ = op::sequence; p.kids_ = std::move(kids); return p; }
+};
+
+/*
+ * The parser of the rule texts, one pattern for each line ('#' for comments):
+ *  _                       wildcard
+ *  null                    null pointer
+ *  42, 0x2a, -1.5, "text"  constants
+ *  1..9, 0.5..1.0          ranges (closed, lo <= hi)
+ *  /\w+@\w+/               regex (a whole match, '\/' for a slash)
+ *  node("left", _, null)   registered-type constructor
+ *  [1, _, 3]               sequence (of the first elements)
+ * A rule nested deeper than max_depth throws a length_error, as it couldn't be compiled anyway.
+*/
+
+enum : size_t { max_depth = 256 };
+
+struct parse_error : std::runtime_error
+{
+    size_t pos_;
+    parse_error(const std::string& what, size_t pos)
+        : std::runtime_error(what), pos_(pos)
+    {}
+};
+
+class parser
+{
+    const std::string& s_;
+    size_t             i_     = 0;
+    size_t             depth_ = 0; // of the records & sequences
+
+    void skip(void)
+    {
+        while ((i_ < s_.size()) && ((s_[i_] == ' ') || (s_[i_] == '\t') || (s_[i_] == '\r'))) ++i_;
+    }
+
+    bool eat(char c)
+    {
+        skip();
+        if ((i_ < s_.size()) && (s_[i_] == c)) { ++i_; return true; }
+        return false;
+    }
+
+    [[noreturn]] void fail(const char* what) const
+    {
+        throw parse_error(std::string(what) + " at column " + std::to_string(i_ + 1), i_);
+    }
+
+    std::vector<pattern> list(char close)
+    {
+        if (depth_ >= max_depth) throw std::length_error("The rule is too deep.");
+        ++depth_;
+        std::vector<pattern> kids;
+        if (!eat(close))
+        {
+            do kids.push_back(parse()); while (eat(','));
+            if (!eat(close)) fail("expected a ',' or a closing bracket");
+        }
+        --depth_;
+        return kids;
+    }
+
+    std::string quoted(char q)
+    {
+        std::string r;
+        for (++i_; (i_ < s_.size()) && (s_[i_] != q); ++i_)
+        {
+            if ((s_[i_] == '\\') && (i_ + 1 < s_.size()) && ((s_[i_ + 1] == q) || (q == '"')))
+            {
+                ++i_;
+                if ((q == '"') && (s_[i_] == 'n')) { r += '\n'; continue; }
+                if ((q == '"') && (s_[i_] == 't')) { r += '\t'; continue; }
+            }
+            r += s_[i_];
+        }
+        if (i_ >= s_.size()) fail("unterminated string");
+        ++i_;
+        return r;
+    }
+
+    // A decimal integer, or a hexadecimal one with "0x" (a leading 0 doesn't make it octal).
+
+    static std::int64_t to_int(const char* b, char** e)
+    {
+        const char* d = b + ((*b == '-') || (*b == '+'));
+        bool hex = (d[0] == '0') && ((d[1] == 'x') || (d[1] == 'X'));
+        return std::strtoll(b, e, hex ? 16 : 10);
+    }
+
+    pattern number(void)
+    {
+        const char* b = s_.c_str() + i_;
+        char* e = nullptr;
+        size_t n = std::strspn(b, "+-0123456789");
+        bool real = ((b[n] == '.') && (b[n + 1] != '.')) || (b[n] == 'e') || (b[n] == 'E');
+        if (real)
+        {
+            double lo = std::strtod(b, &e);
+            i_ += e - b;
+            if (!eat('.')) return pattern::real(lo);
+            if (!eat('.')) fail("expected '..'");
+            skip();
+            b = s_.c_str() + i_;
+            double hi = std::strtod(b, &e);
+            if (e == b) fail("expected a number");
+            i_ += e - b;
+            if (!(lo <= hi)) fail("the range is empty");
+            return pattern::range(lo, hi);
+        }
+        std::int64_t lo = to_int(b, &e);
+        if (e == b) fail("expected a number");
+        i_ += e - b;
+        if (!eat('.')) return pattern::integer(lo);
+        if (!eat('.')) fail("expected '..'");
+        skip();
+        b = s_.c_str() + i_;
+        std::int64_t hi = to_int(b, &e);
+        if (e == b) fail("expected a number");
+        i_ += e - b;
+        if (hi < lo) fail("the range is empty");
+        return pattern::range(lo, hi);
+    }
+
+public:
+    parser(const std::string& s) : s_(s) {}
+
+    pattern parse(void)
+    {
+        skip();
+        if (i_ >= s_.size()) fail("expected a pattern");
+        char c = s_[i_];
+        if (c == '"') return pattern::string(quoted('"'));
+        if (c == '/') return pattern::regex(quoted('/'));
+        if (c == '[') { ++i_; return pattern::sequence(list(']')); }
+        if ((c == '-') || (c == '+') || ((c >= '0') && (c <= '9'))) return number();
+        size_t b = i_;
+        while ((i_ < s_.size()) && (std::isalnum(static_cast<unsigned char>(s_[i_])) || (s_[i_] == '_') || (s_[i_] == ':'))) ++i_;
+        if (b == i_) fail("unexpected character");
+        std::string name = s_.substr(b, i_ - b);
+        if (name == "_")    return pattern::any();
+        if (name == "null") return pattern::null();
+        if (!eat('(')) fail("expected '('");
+        return pattern::record(std::move(name), list(')'));
+    }
+
+    void finish(void)
+    {
+        skip();
+        if (i_ < s_.size()) fail("unexpected trailing characters");
+    }
+};
+
+inline pattern parse(const std::string& text)
+{
+    parser p(text);
+    pattern r = p.parse();
+    p.finish();
+    return r;
+}
+
+inline std::vector<pattern> parse_rules(const std::string& text)
+{
+    std::vector<pattern> rules;
+    size_t b = 0, no = 0;
+    while (b < text.size())
+    {
+        ++no;
+        size_t e = text.find('\n', b);
+        if (e == std::string::npos) e = text.size();
+        std::string line = text.substr(b, e - b);
+        size_t c = line.find_first_not_of(" \t\r");
+        if ((c != std::string::npos) && (line[c] != '#'))
+        {
+            try { rules.push_back(parse(line)); }
+            catch (const parse_error& err)
+            {
+                throw parse_error("line " + std::to_string(no) + ": " + err.what(), b + err.pos_);
+            }
+        }
+        b = e + 1;
+    }
+    return rules;
+}
+
+/*
+ * The compiled program.
+ * The instructions form a stack machine: each one pops a value and checks it, and a record
+ * or sequence instruction pushes its fields/elements (the first one on the top) for the next
+ * instructions, which are emitted in pre-order. The program is only made of flat arrays of
+ * plain data, and could be used through a program_view pointing to any storage.
+*/
+
+struct str_ref { std::uint32_t off_, len_; };
+
+struct program_view
+{
+    const std::uint8_t*  ops_   = nullptr; // [code]
+    const std::uint32_t* args_  = nullptr; // [code], an index into a pool, or the count of fields/elements
+    const std::uint32_t* extra_ = nullptr; // [code], the type index of a record
+    size_t               code_  = 0;
+    const std::uint32_t* rules_ = nullptr; // [rules + 1], the first instruction of each rule
+    size_t               count_ = 0;
+    const std::int64_t*  ints_  = nullptr;
+    const double*        reals_ = nullptr;
+    const str_ref*       strs_  = nullptr; // string constants, regex sources & type names
+    size_t               nstrs_ = 0;
+    const char*          chars_ = nullptr;
+};
+
+class program
+{
+    std::vector<std::uint8_t>  ops_;
+    std::vector<std::uint32_t> args_, extra_, rules_;
+    std::vector<std::int64_t>  ints_;
+    std::vector<double>        reals_;
+    std::vector<str_ref>       strs_;
+    std::vector<char>          chars_;
+
+    std::unordered_map<std::string, std::uint32_t> str_ids_;
+
+    std::uint32_t add_str(const std::string& s)
+    {
+        auto it = str_ids_.emplace(s, static_cast<std::uint32_t>(strs_.size()));
+        if (!it.second) return it.first->second;
+        strs_.push_back({ static_cast<std::uint32_t>(chars_.size()), static_cast<std::uint32_t>(s.size()) });
+        chars_.insert(chars_.end(), s.begin(), s.end());
+        return it.first->second;
+    }
+
+    template <typename T>
+    static std::uint32_t add_to(std::vector<T>& pool, T v)
+    {
+        pool.push_back(v);
+        return static_cast<std::uint32_t>(pool.size() - 1);
+    }
+
+    void emit(op o, std::uint32_t a, std::uint32_t x = 0)
+    {
+        ops_  .push_back(static_cast<std::uint8_t>(o));
+        args_ .push_back(a);
+        extra_.push_back(x);
+    }
+
+    size_t emit(const pattern& p, size_t depth)
+    {
+        size_t top = depth;
+        switch (p.op_)
+        {
+        case op::any:        emit(p.op_, 0); break;
+        case op::null:       emit(p.op_, 0); break;
+        case op::int_eq:     emit(p.op_, add_to(ints_, p.i_[0])); break;
+        case op::real_eq:    emit(p.op_, add_to(reals_, p.r_[0])); break;
+        case op::int_range:  emit(p.op_, add_to(ints_, p.i_[0])); add_to(ints_, p.i_[1]); break;
+        case op::real_range: emit(p.op_, add_to(reals_, p.r_[0])); add_to(reals_, p.r_[1]); break;
+        case op::str_eq:
+        case op::regex:      emit(p.op_, add_str(p.s_)); break;
+        case op::record:
+        case op::sequence:
+            emit(p.op_, static_cast<std::uint32_t>(p.kids_.size()), (p.op_ == op::record) ? add_str(p.s_) : 0);
+            for (size_t i = 0; i < p.kids_.size(); ++i)
+            {
+                // the kid i is on the top of the (n - i) values left
+                size_t d = emit(p.kids_[i], depth + p.kids_.size() - i - 1);
+                if (d > top) top = d;
+            }
+            break;
+        }
+        if (top >= max_depth) throw std::length_error("The rule is too deep.");
+        return top;
+    }
+
+public:
+    program(void) = default;
+
+    explicit program(const std::vector<pattern>& rules)
+    {
+        for (auto& r : rules) add(r);
+    }
+
+    // Adds a rule. If it throws (e.g. the rule is too deep), the program is left as it was.
+
+    size_t add(const pattern& rule)
+    {
+        if (rules_.empty()) rules_.push_back(0);
+        const size_t code = ops_.size(), ints = ints_.size(), reals = reals_.size(), 
+                     strs = strs_.size(), chars = chars_.size();
+        try { emit(rule, 1); }
+        catch (...)
+        {
+            ops_.resize(code); args_.resize(code); extra_.resize(code);
+            ints_.resize(ints); reals_.resize(reals); strs_.resize(strs); chars_.resize(chars);
+            for (auto it = str_ids_.begin(); it != str_ids_.end();)
+            {
+                if (it->second >= strs) it = str_ids_.erase(it);
+                else ++it;
+            }
+            throw;
+        }
+        rules_.push_back(static_cast<std::uint32_t>(ops_.size()));
+        return rules_.size() - 2;
+    }
+
+    size_t size(void) const { return rules_.empty() ? 0 : rules_.size() - 1; }
+
+    program_view view(void) const
+    {
+        program_view v;
+        v.ops_   = ops_.data();
+        v.args_  = args_.data();
+        v.extra_ = extra_.data();
+        v.code_  = ops_.size();
+        v.rules_ = rules_.data();
+        v.count_ = size();
+        v.ints_  = ints_.data();
+        v.reals_ = reals_.data();
+        v.strs_  = strs_.data();
+        v.nstrs_ = strs_.size();
+        v.chars_ = chars_.data();
+        return v;
+    }
+};
+
+inline program compile(const std::string& text)
+{
+    return program(parse_rules(text));
+}
+
+/*
+ * The matcher runs a program on the values.
+ * It resolves the type names through a registry and compiles the regexes once, when it's created,
+ * and throws an invalid_argument if a type name isn't in the registry.
+*/
+
+class matcher
+{
+    program_view                                  p_;
+    std::vector<const descriptor*>                types_;   // by the string index
+    std::vector<std::unique_ptr<const std::regex>> regexes_; // by the string index
+
+public:
+    matcher(const program_view& p, const registry& reg)
+        : p_(p), types_(p.nstrs_, nullptr), regexes_(p.nstrs_)
+    {
+        for (size_t pc = 0; pc < p_.code_; ++pc)
+        {
+            auto o = static_cast<op>(p_.ops_[pc]);
+            if (o == op::record)
+            {
+                const str_ref& s = p_.strs_[p_.extra_[pc]];
+                types_[p_.extra_[pc]] = reg.find(p_.chars_ + s.off_, s.len_);
+                if (types_[p_.extra_[pc]] == nullptr)
+                {
+                    throw std::invalid_argument("Unknown record type \"" + std::string(p_.chars_ + s.off_, s.len_) + "\".");
+                }
+            }
+            else if ((o == op::regex) && !regexes_[p_.args_[pc]])
+            {
+                const str_ref& s = p_.strs_[p_.args_[pc]];
+                regexes_[p_.args_[pc]].reset(new std::regex(p_.chars_ + s.off_, s.len_));
+            }
+        }
+    }
+
+    size_t size(void) const { return p_.count_; }
+
+    // Runs the rule i on the value.
+
+    bool test(size_t i, const value& v) const
+    {
+        value stack[max_depth];
+        size_t sp = 0;
+        stack[sp++] = v;
+        for (size_t pc = p_.rules_[i], end = p_.rules_[i + 1]; pc < end; ++pc)
+        {
+            value t = stack[--sp];
+            if (t.desc_->kind_ == kind::pointer)
+            {
+                t = t.ptr_ && *static_cast<const void* const*>(t.ptr_) ? 
+                    value { t.desc_->target_(), *static_cast<const void* const*>(t.ptr_) } : value { nullptr, nullptr };
+            }
+            std::uint32_t a = p_.args_[pc];
+            switch (static_cast<op>(p_.ops_[pc]))
+            {
+            case op::any:
+                break;
+            case op::null:
+                if (t.desc_ != nullptr) return false;
+                break;
+            case op::int_eq:
+                {
+                    std::int64_t x;
+                    if (!t.desc_ || !load_int(t, x) || (x != p_.ints_[a])) return false;
+                }
+                break;
+            case op::int_range:
+                {
+                    std::int64_t x;
+                    if (!t.desc_ || !load_int(t, x) || (x < p_.ints_[a]) || (p_.ints_[a + 1] < x)) return false;
+                }
+                break;
+            case op::real_eq:
+                {
+                    double x;
+                    if (!t.desc_ || !load_real(t, x) || (x != p_.reals_[a])) return false;
+                }
+                break;
+            case op::real_range:
+                {
+                    double x;
+                    if (!t.desc_ || !load_real(t, x) || !((p_.reals_[a] <= x) && (x <= p_.reals_[a + 1]))) return false;
+                }
+                break;
+            case op::str_eq:
+                {
+                    if (!t.desc_ || (t.desc_->kind_ != kind::string)) return false;
+                    const char* s; size_t n;
+                    t.desc_->str_(t.ptr_, s, n);
+                    const str_ref& r = p_.strs_[a];
+                    if ((n != r.len_) || ((n != 0) && (std::memcmp(s, p_.chars_ + r.off_, n) != 0))) return false;
+                }
+                break;
+            case op::regex:
+                {
+                    if (!t.desc_ || (t.desc_->kind_ != kind::string)) return false;
+                    const char* s; size_t n;
+                    t.desc_->str_(t.ptr_, s, n);
+                    if (!s || !std::regex_match(s, s + n, *regexes_[a])) return false;
+                }
+                break;
+            case op::record:
+                {
+                    if (!t.desc_ || (t.desc_ != types_[p_.extra_[pc]]) || (a > t.desc_->fields_)) return false;
+                    for (size_t k = a; k > 0; --k)
+                    {
+                        const value& f = t.desc_->field_[k - 1];
+                        stack[sp++] = { f.desc_, static_cast<const char*>(t.ptr_) + reinterpret_cast<std::uintptr_t>(f.ptr_) };
+                    }
+                }
+                break;
+            case op::sequence:
+                {
+                    if (!t.desc_ || (t.desc_->kind_ != kind::sequence)) return false;
+                    if (t.desc_->elements_(t.ptr_, a, stack + sp) != a) return false;
+                    for (size_t l = sp, r = sp + a; l + 1 < r; ++l, --r) std::swap(stack[l], stack[r - 1]);
+                    sp += a;
+                }
+                break;
+            }
+        }
+        return true;
+    }
+
+    // Returns the index of the first matched rule, or -1 if there is none.
+
+    template <typename T>
+    long first(const T& x) const
+    {
+        value v = view(x);
+        for (size_t i = 0; i < p_.count_; ++i)
+        {
+            if (test(i, v)) return static_cast<long>(i);
+        }
+        return -1;
+    }
+
+    // Calls f(i) for each matched rule.
+
+    template <typename T, typename F>
+    void all(const T& x, F&& f) const
+    {
+        value v = view(x);
+        for (size_t i = 0; i < p_.count_; ++i)
+        {
+            if (test(i, v)) f(i);
+        }
+    }
+};
+
+} // namespace rt
+} // namespace match